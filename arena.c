@@ -0,0 +1,105 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Bytes in each block, unless an allocation needs more */
+#define ARENA_BLOCK_SIZE (64u << 10)
+
+/* Alignment of every allocation */
+#define ARENA_ALIGNMENT 16u
+
+typedef struct block {
+    struct block * next;
+    size_t size;
+    size_t used;
+} block_t;
+
+struct arena {
+    struct block * blocks;
+};
+
+/* Allocations start past the header, at an aligned offset */
+static size_t header_size(void) {
+    return (sizeof(struct block) + ARENA_ALIGNMENT - 1) &
+        ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+arena_t * new_arena(void) {
+    arena_t * ret = malloc(sizeof(arena_t));
+    if (ret) {
+        ret->blocks = NULL;
+    }
+
+    return ret;
+}
+
+void delete_arena(arena_t * arena) {
+    if (!(arena)) {
+        return;
+    }
+
+    struct block * block = arena->blocks;
+    while (block) {
+        struct block * next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+void * arena_alloc(arena_t * arena, size_t size) {
+    assert(arena);
+
+    if (size > SIZE_MAX - header_size() - ARENA_ALIGNMENT) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+
+    struct block * block = arena->blocks;
+    if (!(block) || block->size - block->used < size) {
+        size_t block_size = header_size() + size;
+        if (block_size < ARENA_BLOCK_SIZE) {
+            block_size = ARENA_BLOCK_SIZE;
+        }
+
+        block = malloc(block_size);
+        if (!(block)) {
+            return NULL;
+        }
+
+        block->size = block_size;
+        block->used = header_size();
+        if (arena->blocks && block_size > ARENA_BLOCK_SIZE) {
+            /* Keep bumping through the current block afterwards */
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        } else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void * ret = (uint8_t *) block + block->used;
+    block->used += size;
+    return ret;
+}
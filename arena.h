@@ -0,0 +1,40 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BF__ARENA_H__
+#define __BF__ARENA_H__
+
+#include <stddef.h>
+
+/**
+ * A bump-pointer arena for scratch memory that lives as long as a
+ * compilation.  Allocations are never freed one at a time; delete_arena
+ * releases them all at once.
+ */
+typedef struct arena arena_t;
+
+arena_t * new_arena(void);
+void delete_arena(arena_t * arena);
+
+/**
+ * Returns size bytes, suitably aligned for any type, or NULL if no memory is
+ * available.
+ */
+void * arena_alloc(arena_t * arena, size_t size);
+
+#endif // __BF__ARENA_H__
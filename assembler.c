@@ -18,119 +18,524 @@
 
 #define _GNU_SOURCE
 
+#include "arena.h"
 #include <assert.h>
 #include "common.h"
 #include "constants.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Jumps are emitted in their rel32 form unless their target is already known
+ * to be near, and relaxed to rel8 once every label is placed.
+ */
+typedef enum source_kind {
+    source_rel32,               /* call, RIP-relative operands */
+    source_jmp,                 /* E9 cd, relaxable to EB cb */
+    source_jcc,                 /* 0F 8x cd, relaxable to 7x cb */
+    source_rel8                 /* EB cb or 7x cb */
+} source_kind_t;
 
 typedef struct source {
-    int32_t * ptr;
-    struct source * next;
+    struct label * label;
+    size_t offset;              /* of the displacement */
+    size_t slack;               /* of the buffer, when emitted */
+    source_kind_t kind;
+    uint8_t cc;                 /* for source_jcc */
+    unsigned relaxed;
 } source_t;
 
+/*
+ * emit_align pads to its alignment from wherever it lands, so relaxing a
+ * jump before it may grow its padding by up to alignment - 1 bytes.
+ */
+typedef struct align {
+    size_t offset;              /* of the padding */
+    size_t size;
+    size_t alignment;
+} align_t;
+
 typedef struct label {
     unsigned resolved;
-    void * ptr;
+    size_t offset;
+    size_t slack;
 
-    struct source * sources;
     struct label * next;
 } label_t;
 
 typedef struct assembler_buffer {
     unsigned finalized;
+    unsigned failed;            /* to grow the buffer, or allocate */
+    unsigned out_of_memory;     /* for labels, sources or aligns */
     void * buffer;
     size_t buffer_size;
     size_t offset;
+
+    /* Labels are allocated here, and the placed ones linked in order */
+    arena_t * arena;
     struct label * labels;
+
+    /* Handed out in place of a label once allocating one fails */
+    struct label failed_label;
+
+    struct source * sources;
+    size_t source_count;
+    size_t source_capacity;
+
+    struct align * aligns;
+    size_t align_count;
+    size_t align_capacity;
+
+    /* The most the padding emitted so far may grow by */
+    size_t slack;
 } assembler_buffer_t;
 
 /* Prototypes */
 assembler_buffer_t * new_assembler_buffer(void);
 void * finalize_assembler_buffer(assembler_buffer_t * buf);
+int is_out_of_memory(const assembler_buffer_t * buf);
 void delete_assembler_buffer(assembler_buffer_t * buf);
-label_t * new_label(void);
-void delete_label(label_t * lab);
+label_t * new_label(assembler_buffer_t * buf);
 void emit_add_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
+void emit_add_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_add_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_add_rm16disp_imm16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint16_t imm);
+void emit_add_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_add_rm32disp_imm32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint32_t imm);
+void emit_add_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_add_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
+void emit_add_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_add_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
 void emit_add_r_immz32( assembler_buffer_t * buf, asm_register_t reg, uint32_t imm);
 void emit_and_r_immz32( assembler_buffer_t * buf, asm_register_t reg, uint32_t imm);
+void emit_and_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_align(        assembler_buffer_t * buf, size_t alignment);
+void emit_bsf_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_bsr_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
 void emit_call(         assembler_buffer_t * buf, uintptr_t imm);
+void emit_call_label(   assembler_buffer_t * buf, label_t * lab);
+void emit_cmp_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
 void emit_cmp_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
+void emit_cmp_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_cmp_rm16disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_cmp_rm32disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm);
 void emit_cmp_r_immz32( assembler_buffer_t * buf, asm_register_t reg, uint32_t imm);
 void emit_cmp_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg);
+void emit_data(         assembler_buffer_t * buf, const void * data, size_t size);
+void emit_div_r(        assembler_buffer_t * buf, asm_register_t reg);
+void emit_imul_r_r(     assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_imul_r_r_imm8(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, uint8_t imm);
+void emit_imul_r_r_imm32(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, uint32_t imm);
 void emit_je(           assembler_buffer_t * buf, label_t * lab);
+void emit_jg(           assembler_buffer_t * buf, label_t * lab);
 void emit_jle(          assembler_buffer_t * buf, label_t * lab);
 void emit_jmp(          assembler_buffer_t * buf, label_t * lab);
+void emit_jmp_r(        assembler_buffer_t * buf, asm_register_t reg);
 void emit_jne(          assembler_buffer_t * buf, label_t * lab);
+void emit_kmovq_r_k(     assembler_buffer_t * buf, asm_register_t reg, asm_mask_register_t sreg);
+void emit_kortestq_k_k( assembler_buffer_t * buf, asm_mask_register_t reg, asm_mask_register_t sreg);
+void emit_lea_r_rmdisp( assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_lea_r_rmindex(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, asm_register_t index, uint8_t scale, int32_t disp);
 void emit_leave(        assembler_buffer_t * buf);
+void emit_mov_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
+void emit_mov_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
 void emit_mov_r8_rm8(   assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_mov_r8_rm8disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_mov_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm);
 void emit_mov_rm8_r8(   assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_mov_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_mov_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_mov_rm16disp_imm16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint16_t imm);
+void emit_mov_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_mov_rm32disp_imm32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint32_t imm);
+void emit_mov_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_mov_r32_rm32disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, int32_t disp);
 void emit_mov_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
 void emit_mov_r_immptr( assembler_buffer_t * buf, asm_register_t reg, uintptr_t imm);
+void emit_mov_r_imm32(  assembler_buffer_t * buf, asm_register_t reg, uint32_t imm);
+void emit_movd_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t sreg);
+void emit_movd_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg, int32_t disp);
 void emit_mov_rm_rint(  assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_movdqa_x_rm(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg);
+void emit_movdqu_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t sreg);
+void emit_movdqu_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_movq_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t sreg);
+void emit_movq_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_movzx_r_rm8disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_movzx_r_rm16disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_neg_r(        assembler_buffer_t * buf, asm_register_t reg);
+void emit_paddb_x_label(assembler_buffer_t * buf, asm_xmm_register_t reg, label_t * lab);
+void emit_pcmpeqb_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg);
+void emit_pcmpeqd_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg);
+void emit_pcmpeqw_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg);
+void emit_pmovmskb_r_x( assembler_buffer_t * buf, asm_register_t reg, asm_xmm_register_t sreg);
 void emit_pop_r(        assembler_buffer_t * buf, asm_register_t reg);
 void emit_push_r(       assembler_buffer_t * buf, asm_register_t reg);
 void emit_push_label(   assembler_buffer_t * buf, struct label * lab);
+void emit_pxor_x_x(     assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg);
 void emit_ret(          assembler_buffer_t * buf);
+void emit_rol_r_cl(     assembler_buffer_t * buf, asm_register_t reg);
+void emit_setne_r8(     assembler_buffer_t * buf, asm_register_t reg);
+void emit_shl_r_cl(     assembler_buffer_t * buf, asm_register_t reg);
 void emit_sub_r_immz32( assembler_buffer_t * buf, asm_register_t reg, uint32_t imm);
+void emit_sub_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_sub_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_sub_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_sub_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t sreg);
+void emit_tzcnt_r_r(     assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
+void emit_vmovdqa_y_rm( assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg);
+void emit_vmovdqa64_z_rm(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg);
+void emit_vmovdqu_rmdisp_y(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t sreg);
+void emit_vmovdqu_y_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_vmovdqu64_rmdisp_z(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t sreg);
+void emit_vmovdqu64_z_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t sreg, int32_t disp);
+void emit_vpaddb_y_y_label(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, label_t * lab);
+void emit_vpaddb_z_z_label(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, label_t * lab);
+void emit_vpcmpeqb_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, asm_xmm_register_t sreg2);
+void emit_vpcmpeqb_k_z_z(assembler_buffer_t * buf, asm_mask_register_t reg, asm_xmm_register_t sreg1, asm_xmm_register_t sreg2);
+void emit_vpcmpeqd_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, asm_xmm_register_t sreg2);
+void emit_vpcmpeqw_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, asm_xmm_register_t sreg2);
+void emit_vpmovmskb_r_y(assembler_buffer_t * buf, asm_register_t reg, asm_xmm_register_t sreg);
+void emit_vpxor_y_y_y(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t sreg1, asm_xmm_register_t sreg2);
+void emit_vzeroupper(   assembler_buffer_t * buf);
 void emit_xor_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t sreg);
 
 /* Internal functions */
 
-static int check_space( const struct assembler_buffer * buf, size_t o) {
-    /* TODO Check for overflow */
+static size_t page_size(void) {
+    long ret = sysconf(_SC_PAGESIZE);
+    return ret > 0 ? (size_t) ret : 4096u;
+}
+
+/*
+ * Ensures o more bytes fit, doubling the mapping as needed.  Labels and
+ * sources are kept as offsets, so the mapping is free to move.  On failure,
+ * the buffer is marked failed and finalize_assembler_buffer refuses it.
+ */
+static int check_space( struct assembler_buffer * buf, size_t o) {
     assert(buf);
-    return (buf->offset + o < buf->buffer_size);
+    if (buf->failed) {
+        return 0;
+    } else if (o <= buf->buffer_size - buf->offset) {
+        return 1;
+    }
+
+    size_t size = buf->buffer_size;
+    while (o > size - buf->offset) {
+        if (size > SIZE_MAX / 2) {
+            buf->failed = 1u;
+            return 0;
+        }
+        size *= 2;
+    }
+
+    #if defined(MREMAP_MAYMOVE)
+    void * buffer = mremap(buf->buffer, buf->buffer_size, size,
+        MREMAP_MAYMOVE);
+    if (buffer == MAP_FAILED) {
+        buf->failed = 1u;
+        return 0;
+    }
+    #else
+    void * buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        buf->failed = 1u;
+        return 0;
+    }
+
+    memcpy(buffer, buf->buffer, buf->offset);
+    munmap(buf->buffer, buf->buffer_size);
+    #endif
+
+    buf->buffer = buffer;
+    buf->buffer_size = size;
+    return 1;
 }
 
+/*
+ * Emitters assert check_space for the whole instruction up front; these
+ * check again, so the buffer still grows when assertions are compiled out.
+ */
 static void emit_u8(    struct assembler_buffer * buf, uint8_t v) {
-    /* assert(check_space(buf, sizeof(v))); */
+    if (!(check_space(buf, sizeof(v)))) {
+        return;
+    }
 
     *((uint8_t *) buf->buffer + buf->offset) = v;
     buf->offset += sizeof(v);
 }
 
+static void emit_u16(   struct assembler_buffer * buf, uint16_t v) {
+    if (!(check_space(buf, sizeof(v)))) {
+        return;
+    }
+
+    memcpy((uint8_t *) buf->buffer + buf->offset, &v, sizeof(v));
+    buf->offset += sizeof(v);
+}
+
 static void emit_u32(   struct assembler_buffer * buf, uint32_t v) {
-    /* assert(check_space(buf, sizeof(v))); */
+    if (!(check_space(buf, sizeof(v)))) {
+        return;
+    }
 
-    *((uint32_t *) ((uint8_t *) buf->buffer + buf->offset)) = v;
+    memcpy((uint8_t *) buf->buffer + buf->offset, &v, sizeof(v));
     buf->offset += sizeof(v);
 }
 
 static void emit_ptr(   struct assembler_buffer * buf, uintptr_t v) {
-    /* assert(check_space(buf, sizeof(v))); */
+    if (!(check_space(buf, sizeof(v)))) {
+        return;
+    }
 
-    *((uintptr_t *) ((uint8_t *) buf->buffer + buf->offset)) = v;
+    memcpy((uint8_t *) buf->buffer + buf->offset, &v, sizeof(v));
     buf->offset += sizeof(v);
 }
 
-static void emit_source(struct assembler_buffer * buf, struct label * lab) {
+/*
+ * Emits a ModRM byte addressing [base + index * scale + disp], with a SIB
+ * byte if one is needed and the displacement in its shortest form.  An index
+ * of ESP means there is none.  Only the low three bits of each register are
+ * encoded here; the prefix carries the rest.
+ *
+ * An 8-bit displacement counts units of n bytes, which is 1 except under an
+ * EVEX prefix, where it is the size of the memory operand.
+ */
+static void emit_modrm_scaled(struct assembler_buffer * buf, uint8_t reg,
+        asm_register_t base, asm_register_t index, uint8_t scale,
+        int32_t disp, int32_t n) {
+    assert(scale == 1 || scale == 2 || scale == 4 || scale == 8);
+    assert(index != ESP || scale == 1);
+
+    /* r/m = 100 escapes to a SIB byte, which ESP and R12 as a base need. */
+    const uint8_t low = (uint8_t) (base & 7);
+    const int sib = index != ESP || low == ESP;
+    const uint8_t rm = sib ? 0x04 : low;
+    const uint8_t modrm = (uint8_t) (((reg & 7) << 3) | rm);
+
+    /* mod = 00 with EBP or R13 as the base means disp32 without one. */
+    uint8_t mod;
+    if (disp == 0 && low != EBP) {
+        mod = 0x00;
+    } else if (disp % n == 0 && disp / n >= INT8_MIN && disp / n <= INT8_MAX) {
+        mod = 0x40;
+    } else {
+        mod = 0x80;
+    }
+    emit_u8(buf, (uint8_t) (mod | modrm));
+
+    if (sib) {
+        const uint8_t ss = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+        emit_u8(buf, (uint8_t) ((ss << 6) | ((index & 7) << 3) | low));
+    }
+
+    if (mod == 0x40) {
+        emit_u8(buf, (uint8_t) (int8_t) (disp / n));
+    } else if (mod == 0x80) {
+        emit_u32(buf, (uint32_t) disp);
+    }
+}
+
+static void emit_modrm_sib(struct assembler_buffer * buf, uint8_t reg,
+        asm_register_t base, asm_register_t index, uint8_t scale,
+        int32_t disp) {
+    emit_modrm_scaled(buf, reg, base, index, scale, disp, 1);
+}
+
+/* Emits a ModRM byte addressing [base + disp]. */
+static void emit_modrm_disp(struct assembler_buffer * buf, uint8_t reg,
+        asm_register_t base, int32_t disp) {
+    emit_modrm_sib(buf, reg, base, ESP, 1, disp);
+}
+
+/* As emit_modrm_disp, for a 64-byte operand under an EVEX prefix. */
+static void emit_modrm_zmm(struct assembler_buffer * buf, uint8_t reg,
+        asm_register_t base, int32_t disp) {
+    emit_modrm_scaled(buf, reg, base, ESP, 1, disp, 64);
+}
+
+/*
+ * Emits the REX prefix needed for a 64-bit operand size, if w is set, or to
+ * name reg, in the ModRM reg field, index, in the SIB byte, or rm, in the r/m
+ * or opcode field, if any is one of R8 through R15.  Only x86_64 has these.
+ */
+static void emit_rex_w(struct assembler_buffer * buf, unsigned w,
+        asm_register_t reg, asm_register_t index, asm_register_t rm) {
+    #if defined(HOST_ARCH_X64)
+    if (w || reg >= R8 || index >= R8 || rm >= R8) {
+        /* 0100 W R X B */
+        emit_u8(buf, (uint8_t) ((w ? 0x48 : 0x40) | ((reg >> 3) << 2) |
+            ((index >> 3) << 1) | (rm >> 3)));
+    }
+    #else
+    (void) buf;
+    assert(!(w));
+    assert(reg < 8);
+    assert(index < 8);
+    assert(rm < 8);
+    #endif
+}
+
+static void emit_rex(struct assembler_buffer * buf, asm_register_t reg,
+        asm_register_t rm) {
+    emit_rex_w(buf, 0u, reg, ESP, rm);
+}
+
+#ifndef NDEBUG
+/*
+ * Returns nonzero if reg names its own low byte in a byte operation whether
+ * or not a REX prefix is present.  Without one, 4 through 7 name AH through
+ * BH; with one, SPL through DIL.
+ */
+static int is_byte_register(asm_register_t reg) {
+    return reg < ESP || reg >= R8;
+}
+#endif
+
+/*
+ * Emits the VEX prefix for a 256-bit operation in the 0F map with the SSE
+ * prefix pp, the extra (non-destructive) source register sreg1 and rm in the
+ * r/m field.  Naming R8 through R15 there takes the three byte form.
+ */
+static void emit_vex256(struct assembler_buffer * buf, uint8_t pp,
+        asm_xmm_register_t sreg1, asm_register_t rm) {
+    assert(sreg1 < 8);
+
+    if (rm >= R8) {
+        /* C4 [R X B m-mmmm] [W vvvv L pp], with R, X, B and vvvv inverted */
+        emit_u8(buf, 0xC4);
+        emit_u8(buf, (uint8_t) (0x80 | 0x40 | 0x01));
+        emit_u8(buf, (uint8_t) (((~sreg1 & 0xF) << 3) | 0x04 | pp));
+    } else {
+        /* C5 [R vvvv L pp], with R and vvvv inverted */
+        emit_u8(buf, 0xC5);
+        emit_u8(buf, (uint8_t) (0x80 | ((~sreg1 & 0xF) << 3) | 0x04 | pp));
+    }
+}
+
+static void emit_vex256_66(struct assembler_buffer * buf,
+        asm_xmm_register_t sreg1, asm_register_t rm) {
+    emit_vex256(buf, 0x01, sreg1, rm);
+}
+
+static void emit_vex256_f3(struct assembler_buffer * buf,
+        asm_xmm_register_t sreg1, asm_register_t rm) {
+    emit_vex256(buf, 0x02, sreg1, rm);
+}
+
+/*
+ * Emits the EVEX prefix for an unmasked 512-bit operation in the 0F map with
+ * the SSE prefix pp, operand size bit w, the extra source register sreg1 and
+ * rm in the r/m field, which may be R8 through R15.  Only ZMM0 through ZMM7
+ * are named.
+ */
+static void emit_evex512(struct assembler_buffer * buf, uint8_t pp,
+        unsigned w, unsigned sreg1, asm_register_t rm) {
+    assert(sreg1 < 8);
+
+    /* 62 [R X B R' 0 0 m m] [W vvvv 1 pp] [z L'L b V' aaa], with R, X, B,
+     * R', vvvv and V' inverted */
+    emit_u8(buf, 0x62);
+    emit_u8(buf, (uint8_t) (rm >= R8 ? 0xD1 : 0xF1));
+    emit_u8(buf, (uint8_t) ((w ? 0x80 : 0x00) | ((~sreg1 & 0xF) << 3) |
+        0x04 | pp));
+    emit_u8(buf, 0x48);
+}
+
+/*
+ * Emits the three byte VEX prefix for an operation on mask registers, which
+ * take the 64-bit form, in the 0F map with the SSE prefix pp.
+ */
+static void emit_vex_mask(struct assembler_buffer * buf, uint8_t pp) {
+    /* C4 [R X B m-mmmm] [W vvvv L pp], with R, X, B and vvvv inverted */
+    emit_u8(buf, 0xC4);
+    emit_u8(buf, 0xE1);
+    emit_u8(buf, (uint8_t) (0x80 | 0x78 | pp));
+}
+
+/*
+ * Records a reference to lab at the current offset and writes a temporary
+ * displacement.  Every displacement is written by finalize_assembler_buffer,
+ * once the final position of each label is known.
+ */
+static void emit_source(struct assembler_buffer * buf, struct label * lab,
+        source_kind_t kind, uint8_t cc) {
     assert(buf);
     assert(lab);
-    assert(check_space(buf, sizeof(int32_t)));
 
-    if (lab->resolved) {
-        uint8_t * base = (uint8_t *) buf->buffer + buf->offset;
-        uint8_t * next = base + sizeof(int32_t);
-        int32_t offset = (int32_t) ((uint8_t *)lab->ptr - next);
-        *(int32_t *) base = offset; 
-    } else {
-        /* Link source in */
-        struct source * src = malloc(sizeof(struct source));
-        assert(src); /* Handle better TODO */
-        src->next = lab->sources;
-        lab->sources = src;
+    if (buf->source_count == buf->source_capacity) {
+        size_t capacity = buf->source_capacity ?
+            2 * buf->source_capacity : 64;
+        struct source * sources = realloc(buf->sources,
+            capacity * sizeof(*sources));
+        if (!(sources)) {
+            buf->failed = 1u;
+            buf->out_of_memory = 1u;
+            return;
+        }
+
+        buf->sources = sources;
+        buf->source_capacity = capacity;
+    }
 
-        /* Note location so we can resolve this later. */ 
-        src->ptr  = (int32_t *) ((uint8_t *) buf->buffer + buf->offset);
+    struct source * src = &buf->sources[buf->source_count++];
+    src->label   = lab;
+    src->offset  = buf->offset;
+    src->slack   = buf->slack;
+    src->kind    = kind;
+    src->cc      = cc;
+    src->relaxed = 0u;
+
+    if (kind == source_rel8) {
+        assert(check_space(buf, sizeof(int8_t)));
+        emit_u8(buf, 0);
+    } else {
+        assert(check_space(buf, sizeof(int32_t)));
+        emit_u32(buf, 0);
+    }
+}
 
-        /* Write a temporary value */
-        *(src->ptr) = 0;
+/*
+ * Returns whether a jump emitted now to lab, size bytes long in its rel8
+ * form, is sure to reach it.  Only labels behind us can be known to be near;
+ * relaxing jumps in between only brings them nearer, but padding in between
+ * may grow.
+ */
+static int is_near(const struct assembler_buffer * buf,
+        const struct label * lab, size_t size) {
+    if (!(lab->resolved)) {
+        return 0;
     }
 
-    buf->offset += sizeof(int32_t);
+    size_t distance = buf->offset + size - lab->offset +
+        (buf->slack - lab->slack);
+    return distance <= 128;
+}
+
+/*
+ * Emits a ModRM byte addressing lab relative to the end of the instruction,
+ * which must finish with the displacement.  Only x86_64 has RIP-relative
+ * addressing.
+ */
+static void emit_modrm_label(struct assembler_buffer * buf, uint8_t reg,
+        struct label * lab) {
+    assert(reg < 8);
+
+    #if defined(HOST_ARCH_X64)
+    /* mod = 00, r/m = 101:  RIP + disp32 */
+    emit_u8(buf, (uint8_t) ((reg << 3) | 0x05));
+    emit_source(buf, lab, source_rel32, 0);
+    #else
+    (void) buf;
+    (void) lab;
+    assert(0);
+    #endif
 }
 
 /* Function defintions */
@@ -138,14 +543,33 @@ static void emit_source(struct assembler_buffer * buf, struct label * lab) {
 assembler_buffer_t * new_assembler_buffer(void) {
     assembler_buffer_t * ret = malloc(sizeof(assembler_buffer_t)); 
     if (ret) {
+        ret->arena = new_arena();
+        if (!(ret->arena)) {
+            free(ret);
+            return NULL;
+        }
+
         ret->labels = NULL;
         ret->finalized = 0u;
+        ret->failed = 0u;
+        ret->out_of_memory = 0u;
+
+        ret->sources = NULL;
+        ret->source_count = 0u;
+        ret->source_capacity = 0u;
 
-        ret->buffer_size = 1u << 20;
+        ret->aligns = NULL;
+        ret->align_count = 0u;
+        ret->align_capacity = 0u;
+        ret->slack = 0u;
+
+        /* Start with a page, growing as code is emitted */
+        ret->buffer_size = page_size();
         ret->buffer = mmap(NULL, ret->buffer_size, PROT_READ | PROT_WRITE,
             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         if (ret->buffer == MAP_FAILED) {
             /* Unable to map memory */
+            delete_arena(ret->arena);
             free(ret);
             return NULL;
         }
@@ -156,12 +580,283 @@ assembler_buffer_t * new_assembler_buffer(void) {
     return ret;
 }
 
+/* Bytes before the displacement of src, as it was emitted */
+static size_t opcode_size(const struct source * src) {
+    switch (src->kind) {
+        case source_jcc:
+            return 2;
+        case source_jmp:
+        case source_rel8:
+            return 1;
+        case source_rel32:
+        default:
+            return 0;
+    }
+}
+
+/* Bytes saved by relaxing src */
+static size_t relaxed_size(const struct source * src) {
+    return opcode_size(src) + sizeof(int32_t) - 2;
+}
+
+/*
+ * Where code moves as the buffer is compacted:  an offset at or past old_end,
+ * up to the next relocation, moves by new_end - old_end.
+ */
+typedef struct relocation {
+    size_t old_end;
+    size_t new_end;
+} relocation_t;
+
+static size_t relocate(const struct relocation * relocations, size_t count,
+        size_t offset) {
+    /* Find the last relocation ending at or before offset */
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (relocations[mid].old_end <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return offset;
+    }
+
+    const struct relocation * r = &relocations[lo - 1];
+    return r->new_end + (offset - r->old_end);
+}
+
+/*
+ * Picks rel8 for every jump sure to reach its label.  Relaxing one jump only
+ * brings others nearer, so this repeats until nothing changes.  As in
+ * is_near, padding in between is assumed to grow to its alignment.
+ */
+static int relax_jumps(struct assembler_buffer * buf,
+        struct relocation * relocations) {
+    int relaxed = 0;
+    int changed;
+    size_t i;
+    do {
+        changed = 0;
+
+        /* Sources are recorded in order of offset */
+        size_t count = 0, saved = 0;
+        for (i = 0; i < buf->source_count; i++) {
+            const struct source * src = &buf->sources[i];
+            if (src->relaxed) {
+                saved += relaxed_size(src);
+                relocations[count].old_end = src->offset + sizeof(int32_t);
+                relocations[count].new_end =
+                    relocations[count].old_end - saved;
+                count++;
+            }
+        }
+
+        for (i = 0; i < buf->source_count; i++) {
+            struct source * src = &buf->sources[i];
+            if (src->relaxed ||
+                    (src->kind != source_jmp && src->kind != source_jcc)) {
+                continue;
+            }
+
+            const struct label * lab = src->label;
+            if (!(lab->resolved)) {
+                continue;
+            }
+
+            /* The short jump would end 2 bytes from its start */
+            ptrdiff_t end = (ptrdiff_t) relocate(relocations, count,
+                src->offset - opcode_size(src)) + 2;
+            ptrdiff_t target = (ptrdiff_t)
+                relocate(relocations, count, lab->offset);
+            if (target >= end) {
+                ptrdiff_t slack = (ptrdiff_t) (lab->slack - src->slack);
+                if (target - end + slack > INT8_MAX) {
+                    continue;
+                }
+            } else {
+                ptrdiff_t slack = (ptrdiff_t) (src->slack - lab->slack);
+                if (target - end - slack < INT8_MIN) {
+                    continue;
+                }
+            }
+
+            src->relaxed = 1u;
+            relaxed = 1;
+            changed = 1;
+        }
+    } while (changed);
+
+    return relaxed;
+}
+
+/*
+ * Fills size bytes at dst with as few nops as the recommended multi-byte forms
+ * allow.
+ */
+static void fill_nops(uint8_t * dst, size_t size) {
+    static const uint8_t nops[9][9] = {
+        {0x90},
+        {0x66, 0x90},
+        {0x0F, 0x1F, 0x00},
+        {0x0F, 0x1F, 0x40, 0x00},
+        {0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+        {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+    };
+
+    while (size > 0) {
+        const size_t n = size < sizeof(nops[0]) ? size : sizeof(nops[0]);
+        memcpy(dst, nops[n - 1], n);
+        dst  += n;
+        size -= n;
+    }
+}
+
+/*
+ * Rewrites relaxed jumps in their short form and repads alignments, moving
+ * the code between them down in place.  Returns the relocations made.
+ */
+static size_t compact(struct assembler_buffer * buf,
+        struct relocation * relocations) {
+    uint8_t * base = buf->buffer;
+    size_t count = 0;
+    size_t read = 0, write = 0;
+    size_t s = 0, a = 0;
+    for (;;) {
+        /* Take the next relaxed source or alignment */
+        while (s < buf->source_count && !(buf->sources[s].relaxed)) {
+            s++;
+        }
+
+        struct source * src = NULL;
+        struct align * align = NULL;
+        size_t start;
+        if (s < buf->source_count && (a == buf->align_count ||
+                buf->sources[s].offset < buf->aligns[a].offset)) {
+            src = &buf->sources[s++];
+            start = src->offset - opcode_size(src);
+        } else if (a < buf->align_count) {
+            align = &buf->aligns[a++];
+            start = align->offset;
+        } else {
+            break;
+        }
+
+        memmove(base + write, base + read, start - read);
+        write += start - read;
+
+        if (src) {
+            /* EB cb, or 70+cc cb */
+            base[write++] = src->kind == source_jmp ?
+                0xEB : (uint8_t) (0x70 | src->cc);
+            read = src->offset + sizeof(int32_t);
+
+            src->kind = source_rel8;
+            src->offset = write;
+            base[write++] = 0;
+        } else {
+            const size_t size = -write & (align->alignment - 1);
+            fill_nops(base + write, size);
+            write += size;
+            read = align->offset + align->size;
+        }
+
+        relocations[count].old_end = read;
+        relocations[count].new_end = write;
+        count++;
+    }
+
+    memmove(base + write, base + read, buf->offset - read);
+    buf->offset = write + (buf->offset - read);
+    return count;
+}
+
+/*
+ * Relaxes what jumps it can and writes every displacement.  Fails on a
+ * reference to a label that was never placed, or when memory runs out.
+ */
+static int resolve_sources(struct assembler_buffer * buf) {
+    struct label * lab;
+    size_t i;
+    size_t entries = buf->source_count + buf->align_count;
+    struct relocation * relocations =
+        malloc((entries ? entries : 1) * sizeof(*relocations));
+    if (!(relocations)) {
+        buf->out_of_memory = 1u;
+        return -1;
+    }
+
+    size_t count = 0;
+    if (relax_jumps(buf, relocations) || buf->align_count > 0) {
+        count = compact(buf, relocations);
+    }
+
+    for (lab = buf->labels; lab; lab = lab->next) {
+        lab->offset = relocate(relocations, count, lab->offset);
+    }
+
+    /* compact has already moved the relaxed sources */
+    for (i = 0; i < buf->source_count; i++) {
+        struct source * src = &buf->sources[i];
+        if (!(src->relaxed)) {
+            src->offset = relocate(relocations, count, src->offset);
+        }
+    }
+
+    int ret = 0;
+    uint8_t * base = buf->buffer;
+    for (i = 0; i < buf->source_count; i++) {
+        const struct source * src = &buf->sources[i];
+        assert(src->label->resolved);
+        if (!(src->label->resolved)) {
+            ret = -1;
+            break;
+        }
+
+        size_t size = src->kind == source_rel8 ?
+            sizeof(int8_t) : sizeof(int32_t);
+        ptrdiff_t next = (ptrdiff_t) (src->offset + size);
+        ptrdiff_t displacement = (ptrdiff_t) src->label->offset - next;
+        if (src->kind == source_rel8) {
+            assert(displacement >= INT8_MIN && displacement <= INT8_MAX);
+            base[src->offset] = (uint8_t) (int8_t) displacement;
+        } else {
+            int32_t rel32 = (int32_t) displacement;
+            memcpy(base + src->offset, &rel32, sizeof(rel32));
+        }
+    }
+
+    free(relocations);
+    return ret;
+}
+
 void * finalize_assembler_buffer(assembler_buffer_t * buf) {
     assert(buf);
 
     if (buf->finalized == 0u) {
         buf->finalized = 1u;
 
+        if (buf->failed || resolve_sources(buf) != 0) {
+            return NULL;
+        }
+
+        /* Trim the mapping to the pages used */
+        size_t page = page_size();
+        size_t size = (buf->offset + page - 1) & ~(page - 1);
+        if (size == 0) {
+            size = page;
+        }
+        if (size < buf->buffer_size) {
+            munmap((uint8_t *) buf->buffer + size, buf->buffer_size - size);
+            buf->buffer_size = size;
+        }
+
         int ret = mprotect(buf->buffer, buf->buffer_size,
             PROT_READ | PROT_EXEC);
         if (ret == -1) {
@@ -172,51 +867,159 @@ void * finalize_assembler_buffer(assembler_buffer_t * buf) {
     return buf->buffer;
 }
 
+int is_out_of_memory(const assembler_buffer_t * buf) {
+    assert(buf);
+    return buf->out_of_memory != 0u;
+}
+
 void delete_assembler_buffer(assembler_buffer_t * buf) {
     if (!(buf)) {
         return;
     }
 
-    struct label * lab = buf->labels;
-    while (lab) {
-        assert(lab->sources == NULL);
-
-        struct label * next = lab->next;
-        delete_label(lab);
-        lab = next;
-    }
+    delete_arena(buf->arena);
+    free(buf->sources);
+    free(buf->aligns);
 
     munmap(buf->buffer, buf->buffer_size);
     free(buf);
 }
 
-label_t * new_label(void) {
-    label_t * ret = malloc(sizeof(label_t));
-    if (ret) {
-        ret->resolved = 0u;
-        ret->sources = NULL;
+/*
+ * Labels live until buf is deleted, whether or not they are placed.  If one
+ * cannot be allocated, the buffer is marked failed, and a placeholder that is
+ * never placed is returned instead.
+ */
+label_t * new_label(assembler_buffer_t * buf) {
+    assert(buf);
+
+    label_t * ret = arena_alloc(buf->arena, sizeof(label_t));
+    if (!(ret)) {
+        buf->failed = 1u;
+        buf->out_of_memory = 1u;
+        ret = &buf->failed_label;
     }
+    ret->resolved = 0u;
+    ret->next = NULL;
 
     return ret;
 }
 
-void delete_label(label_t * lab) {
-    assert(lab);
-    assert(lab->resolved || lab->sources == NULL);
+void emit_add_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    /* 0x80 /0 ib */
+    assert(check_space(buf, 4 + sizeof(int8_t)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x80);
+    emit_modrm_disp(buf, 0, reg, 0);
+    emit_u8(buf, imm);
+}
+
+void emit_add_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm) {
+    /* 0x80 /0 ib */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x80);
+    emit_modrm_disp(buf, 0, reg, disp);
+    emit_u8(buf, imm);
+}
 
-    free(lab);
+void emit_add_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    assert(is_byte_register(srcreg));
+
+    /* 0x00 /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x00);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
 }
 
-void emit_add_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
-    assert(reg < 8);
-    assert(check_space(buf, 3));
+void emit_add_rm16disp_imm16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint16_t imm) {
+    /* 0x66 0x81 /0 iw, or 0x66 0x83 /0 ib for a sign-extended byte */
+    assert(check_space(buf, 5 + sizeof(disp) + sizeof(imm)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, reg);
+    if ((int16_t) imm >= INT8_MIN && (int16_t) imm <= INT8_MAX) {
+        emit_u8(buf, 0x83);
+        emit_modrm_disp(buf, 0, reg, disp);
+        emit_u8(buf, (uint8_t) imm);
+    } else {
+        emit_u8(buf, 0x81);
+        emit_modrm_disp(buf, 0, reg, disp);
+        emit_u16(buf, imm);
+    }
+}
+
+void emit_add_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x66 0x01 /r */
+    assert(check_space(buf, 5 + sizeof(disp)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x01);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_add_rm32disp_imm32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint32_t imm) {
+    /* 0x81 /0 id, or 0x83 /0 ib for a sign-extended byte */
+    assert(check_space(buf, 4 + sizeof(disp) + sizeof(imm)));
+    emit_rex(buf, EAX, reg);
+    if ((int32_t) imm >= INT8_MIN && (int32_t) imm <= INT8_MAX) {
+        emit_u8(buf, 0x83);
+        emit_modrm_disp(buf, 0, reg, disp);
+        emit_u8(buf, (uint8_t) imm);
+    } else {
+        emit_u8(buf, 0x81);
+        emit_modrm_disp(buf, 0, reg, disp);
+        emit_u32(buf, imm);
+    }
+}
+
+void emit_add_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x01 /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x01);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_add_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    assert(is_byte_register(reg));
 
     /* 0x80 /0 ib */
+    assert(check_space(buf, 4));
+    emit_rex(buf, EAX, reg);
     emit_u8(buf, 0x80);
-    emit_u8(buf, (uint8_t) reg);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg & 7)));
     emit_u8(buf, imm);
 }
 
+void emit_add_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(is_byte_register(reg));
+    assert(is_byte_register(srcreg));
+
+    /* 0x00 /r */
+    assert(check_space(buf, 3));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x00);
+    emit_u8(buf, (uint8_t) (0xC0 | ((srcreg & 7) << 3) | (reg & 7)));
+}
+
+void emit_add_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0x01 /r */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0x01 /r */
+    assert(check_space(buf, 2));
+    #endif
+
+    emit_u8(buf, 0x01);
+    emit_u8(buf, (uint8_t) (0xC0 | (srcreg << 3) | reg));
+}
+
 void emit_add_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t imm) {
     assert(reg < 8);
 
@@ -279,33 +1082,165 @@ void emit_and_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t im
     }
 }
 
-void emit_call(         assembler_buffer_t * buf, uintptr_t imm) {
-    emit_mov_r_immptr(buf, EAX, imm);
+void emit_and_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
 
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0x21 /r */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0x21 /r */
     assert(check_space(buf, 2));
+    #endif
 
-    emit_u8(buf, 0xFF);
-    emit_u8(buf, 0xD0);
+    emit_u8(buf, 0x21);
+    emit_u8(buf, (uint8_t) (0xC0 | (srcreg << 3) | reg));
 }
 
-void emit_cmp_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
-    assert(reg < 8);
+void emit_align(        assembler_buffer_t * buf, size_t alignment) {
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    if (buf->align_count == buf->align_capacity) {
+        size_t capacity = buf->align_capacity ?
+            2 * buf->align_capacity : 8;
+        struct align * aligns = realloc(buf->aligns,
+            capacity * sizeof(*aligns));
+        if (!(aligns)) {
+            buf->failed = 1u;
+            buf->out_of_memory = 1u;
+            return;
+        }
 
-    /* 0x80 /7 ib */
-    assert(check_space(buf, 3));
-    emit_u8(buf, 0x80);
-    emit_u8(buf, (uint8_t) (0x38 | reg));
-    emit_u8(buf, imm);
+        buf->aligns = aligns;
+        buf->align_capacity = capacity;
+    }
+
+    struct align * align = &buf->aligns[buf->align_count++];
+    align->offset = buf->offset;
+    align->alignment = alignment;
+
+    /* The buffer itself is page aligned, so pad its offset with nops. */
+    const size_t size = -buf->offset & (alignment - 1);
+    if (check_space(buf, size)) {
+        fill_nops((uint8_t *) buf->buffer + buf->offset, size);
+        buf->offset += size;
+    }
+
+    align->size = buf->offset - align->offset;
+    buf->slack += alignment - 1 - align->size;
 }
 
-void emit_cmp_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t imm) {
+void emit_bsf_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
     assert(reg < 8);
+    assert(srcreg < 8);
 
-    if (reg == EAX) {
-        #if   defined(HOST_ARCH_X64)
-        /* REX.W 0x3D id */
-        assert(check_space(buf, 2 + sizeof(imm)));
-        emit_u8(buf, 0x48);
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0x0F 0xBC /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0x0F 0xBC /r */
+    assert(check_space(buf, 3));
+    #endif
+
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xBC);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_bsr_r_r(      assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0x0F 0xBD /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0x0F 0xBD /r */
+    assert(check_space(buf, 3));
+    #endif
+
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xBD);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_call(         assembler_buffer_t * buf, uintptr_t imm) {
+    emit_mov_r_immptr(buf, EAX, imm);
+
+    assert(check_space(buf, 2));
+
+    emit_u8(buf, 0xFF);
+    emit_u8(buf, 0xD0);
+}
+
+void emit_call_label(   assembler_buffer_t * buf, label_t * lab) {
+    assert(check_space(buf, 1 + sizeof(int32_t)));
+
+    /* E8 cd */
+    emit_u8(buf, 0xE8);
+    emit_source(buf, lab, source_rel32, 0);
+}
+
+void emit_cmp_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    assert(is_byte_register(reg));
+
+    /* 0x80 /7 ib */
+    assert(check_space(buf, 4));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x80);
+    emit_u8(buf, (uint8_t) (0xF8 | (reg & 7)));
+    emit_u8(buf, imm);
+}
+
+void emit_cmp_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    /* 0x80 /7 ib */
+    assert(check_space(buf, 4 + sizeof(int8_t)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x80);
+    emit_modrm_disp(buf, 7, reg, 0);
+    emit_u8(buf, imm);
+}
+
+void emit_cmp_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm) {
+    /* 0x80 /7 ib */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x80);
+    emit_modrm_disp(buf, 7, reg, disp);
+    emit_u8(buf, imm);
+}
+
+void emit_cmp_rm16disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm) {
+    /* 0x66 0x83 /7 ib, sign extending imm */
+    assert(check_space(buf, 5 + sizeof(disp) + sizeof(imm)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x83);
+    emit_modrm_disp(buf, 7, reg, disp);
+    emit_u8(buf, imm);
+}
+
+void emit_cmp_rm32disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm) {
+    /* 0x83 /7 ib, sign extending imm */
+    assert(check_space(buf, 4 + sizeof(disp) + sizeof(imm)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x83);
+    emit_modrm_disp(buf, 7, reg, disp);
+    emit_u8(buf, imm);
+}
+
+void emit_cmp_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t imm) {
+    assert(reg < 8);
+
+    if (reg == EAX) {
+        #if   defined(HOST_ARCH_X64)
+        /* REX.W 0x3D id */
+        assert(check_space(buf, 2 + sizeof(imm)));
+        emit_u8(buf, 0x48);
         #elif defined(HOST_ARCH_IA32)
         /* 0x3D id */
         assert(check_space(buf, 1 + sizeof(imm)));
@@ -346,55 +1281,113 @@ void emit_cmp_r_r(assembler_buffer_t * buf, asm_register_t reg, asm_register_t s
     emit_u8(buf, (uint8_t) (0xC0 | (srcreg << 3) | reg));
 }
 
+void emit_data(         assembler_buffer_t * buf, const void * data, size_t size) {
+    if (!(check_space(buf, size))) {
+        return;
+    }
+
+    memcpy((uint8_t *) buf->buffer + buf->offset, data, size);
+    buf->offset += size;
+}
+
+void emit_div_r(        assembler_buffer_t * buf, asm_register_t reg) {
+    assert(reg < 8);
+
+    /* 0xF7 /6, dividing EDX:EAX */
+    assert(check_space(buf, 2));
+    emit_u8(buf, 0xF7);
+    emit_u8(buf, (uint8_t) (0xF0 | reg));
+}
+
+void emit_imul_r_r(     assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    /* 0x0F 0xAF /r */
+    assert(check_space(buf, 4));
+    emit_rex(buf, reg, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xAF);
+    emit_u8(buf, (uint8_t) (0xC0 | ((reg & 7) << 3) | (srcreg & 7)));
+}
+
+void emit_imul_r_r_imm8(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, uint8_t imm) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x6B /r ib */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x6B);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+    emit_u8(buf, imm);
+}
+
+void emit_imul_r_r_imm32(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, uint32_t imm) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x69 /r id */
+    assert(check_space(buf, 2 + sizeof(imm)));
+    emit_u8(buf, 0x69);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+    emit_u32(buf, imm);
+}
+
+/* Values are the condition codes of Jcc, 70+cc cb and 0F 80+cc cd */
 typedef enum cc_enum {
-    EQ,
-    LE,
-    NEQ
+    EQ  = 0x4,
+    GT  = 0xF,
+    LE  = 0xE,
+    NEQ = 0x5
 } cc_t;
 
 static void emit_jcc(   assembler_buffer_t * buf, label_t * lab, cc_t cc) {
     assert(buf);
     assert(lab);
-    assert(check_space(buf, 2 + sizeof(int32_t)));
 
-    switch (cc) {
-        case EQ:
-            /* OF 84 cd */
-            emit_u8(buf, 0x0F);
-            emit_u8(buf, 0x84);
-            break;
-        case LE:
-            /* 0F 8E cd */
-            emit_u8(buf, 0x0F);
-            emit_u8(buf, 0x8E);
-            break;
-        case NEQ:
-            /* 0F 85 cd */ 
-            emit_u8(buf, 0x0F);
-            emit_u8(buf, 0x85);
-            break;
-        default:
-            assert(0);
-            return;
+    if (is_near(buf, lab, 2)) {
+        /* 70+cc cb */
+        assert(check_space(buf, 2));
+        emit_u8(buf, (uint8_t) (0x70 | cc));
+        emit_source(buf, lab, source_rel8, (uint8_t) cc);
+    } else {
+        /* 0F 80+cc cd */
+        assert(check_space(buf, 2 + sizeof(int32_t)));
+        emit_u8(buf, 0x0F);
+        emit_u8(buf, (uint8_t) (0x80 | cc));
+        emit_source(buf, lab, source_jcc, (uint8_t) cc);
     }
-
-    emit_source(buf, lab);
 }
 
 void emit_je(           assembler_buffer_t * buf, label_t * lab) {
     emit_jcc(buf, lab, EQ);
 }
 
+void emit_jg(           assembler_buffer_t * buf, label_t * lab) {
+    emit_jcc(buf, lab, GT);
+}
+
 void emit_jle(          assembler_buffer_t * buf, label_t * lab) {
     emit_jcc(buf, lab, LE);
 }
 
 void emit_jmp(          assembler_buffer_t * buf, label_t * lab) {
-    assert(check_space(buf, 1 + sizeof(int32_t)));
+    if (is_near(buf, lab, 2)) {
+        /* EB cb */
+        assert(check_space(buf, 2));
+        emit_u8(buf, 0xEB);
+        emit_source(buf, lab, source_rel8, 0);
+    } else {
+        /* E9 cd */
+        assert(check_space(buf, 1 + sizeof(int32_t)));
+        emit_u8(buf, 0xE9);
+        emit_source(buf, lab, source_jmp, 0);
+    }
+}
 
-    /* E9 cd */
-    emit_u8(buf, 0xE9);
-    emit_source(buf, lab);
+void emit_jmp_r(        assembler_buffer_t * buf, asm_register_t reg) {
+    /* 0xFF /4 */
+    assert(check_space(buf, 3));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0xFF);
+    emit_u8(buf, (uint8_t) (0xE0 | (reg & 7)));
 }
 
 void emit_jne(          assembler_buffer_t * buf, label_t * lab) {
@@ -407,25 +1400,165 @@ void emit_leave(        assembler_buffer_t * buf) {
     emit_u8(buf, 0xC9);
 }
 
-void emit_mov_r8_rm8(   assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+void emit_kmovq_r_k(     assembler_buffer_t * buf, asm_register_t reg, asm_mask_register_t srcreg) {
     assert(reg < 8);
-    assert(srcreg < 8);
+
+    /* VEX.L0.F2.0F.W1 0x93 /r */
+    assert(check_space(buf, 5));
+    emit_vex_mask(buf, 0x03);
+    emit_u8(buf, 0x93);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_kortestq_k_k( assembler_buffer_t * buf, asm_mask_register_t reg, asm_mask_register_t srcreg) {
+    /* VEX.L0.0F.W1 0x98 /r */
+    assert(check_space(buf, 5));
+    emit_vex_mask(buf, 0x00);
+    emit_u8(buf, 0x98);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_lea_r_rmdisp( assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    emit_lea_r_rmindex(buf, reg, srcreg, ESP, 1, disp);
+}
+
+void emit_lea_r_rmindex(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, asm_register_t index, uint8_t scale, int32_t disp) {
+    assert(index != ESP || scale == 1);
+
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0x8D /r */
+    assert(check_space(buf, 3 + sizeof(int8_t) + sizeof(disp)));
+    emit_rex_w(buf, 1u, reg, index, srcreg);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0x8D /r */
+    assert(check_space(buf, 2 + sizeof(int8_t) + sizeof(disp)));
+    #endif
+
+    emit_u8(buf, 0x8D);
+    emit_modrm_sib(buf, (uint8_t) reg, srcreg, index, scale, disp);
+}
+
+void emit_mov_r8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    assert(is_byte_register(reg));
+
+    /* 0xB0+rb ib */
+    assert(check_space(buf, 3));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, (uint8_t) (0xB0 | (reg & 7)));
+    emit_u8(buf, imm);
+}
+
+void emit_mov_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(is_byte_register(reg));
+    assert(is_byte_register(srcreg));
+
+    /* 0x88 /r */
+    assert(check_space(buf, 3));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x88);
+    emit_u8(buf, (uint8_t) (0xC0 | ((srcreg & 7) << 3) | (reg & 7)));
+}
+
+void emit_mov_r8_rm8(   assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(is_byte_register(reg));
 
     /* 0x8A /r */
-    assert(check_space(buf, 2));
+    assert(check_space(buf, 3 + sizeof(int8_t)));
+    emit_rex(buf, reg, srcreg);
     emit_u8(buf, 0x8A);
-    emit_u8(buf, (uint8_t) ((reg << 3) | srcreg));
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, 0);
+}
+
+void emit_mov_r8_rm8disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    assert(is_byte_register(reg));
+
+    /* 0x8A /r */
+    assert(check_space(buf, 3 + sizeof(disp)));
+    emit_rex(buf, reg, srcreg);
+    emit_u8(buf, 0x8A);
+    emit_modrm_disp(buf, (uint8_t) (reg & 7), srcreg, disp);
+}
+
+void emit_mov_rm8_imm8( assembler_buffer_t * buf, asm_register_t reg, uint8_t imm) {
+    /* 0xC6 /0 ib */
+    assert(check_space(buf, 4 + sizeof(int8_t)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0xC6);
+    emit_modrm_disp(buf, 0, reg, 0);
+    emit_u8(buf, imm);
 }
 
 void emit_mov_rm8_r8(   assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
-    assert(reg < 8);
-    assert(srcreg < 8);
+    assert(is_byte_register(srcreg));
 
     /* 0x88 /r */
-    assert(check_space(buf, 2));
+    assert(check_space(buf, 3 + sizeof(int8_t)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x88);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, 0);
+}
+
+void emit_mov_rm8disp_imm8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint8_t imm) {
+    /* 0xC6 /0 ib */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0xC6);
+    emit_modrm_disp(buf, 0, reg, disp);
+    emit_u8(buf, imm);
+}
+
+void emit_mov_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    assert(is_byte_register(srcreg));
+
+    /* 0x88 /r */
+    assert(check_space(buf, 3 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x88);
+    emit_modrm_disp(buf, (uint8_t) (srcreg & 7), reg, disp);
+}
+
+void emit_mov_rm16disp_imm16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint16_t imm) {
+    /* 0x66 0xC7 /0 iw */
+    assert(check_space(buf, 5 + sizeof(disp) + sizeof(imm)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0xC7);
+    emit_modrm_disp(buf, 0, reg, disp);
+    emit_u16(buf, imm);
+}
+
+void emit_mov_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x66 0x89 /r */
+    assert(check_space(buf, 5 + sizeof(disp)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x89);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_mov_rm32disp_imm32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, uint32_t imm) {
+    /* 0xC7 /0 id */
+    assert(check_space(buf, 4 + sizeof(disp) + sizeof(imm)));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0xC7);
+    emit_modrm_disp(buf, 0, reg, disp);
+    emit_u32(buf, imm);
+}
 
-    emit_u8(buf, 0x88); 
-    emit_u8(buf, (uint8_t) ((srcreg << 3) | reg));
+void emit_mov_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x89 /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x89);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_mov_r32_rm32disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    /* 0x8B /r, zero extending to all of reg on x86_64 */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, reg, srcreg);
+    emit_u8(buf, 0x8B);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
 }
 
 void emit_mov_r_r(  assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
@@ -460,81 +1593,245 @@ void emit_mov_r_immptr(assembler_buffer_t * buf, asm_register_t reg, uintptr_t i
     emit_ptr(buf, imm);
 }
 
+void emit_mov_r_imm32(  assembler_buffer_t * buf, asm_register_t reg, uint32_t imm) {
+    assert(reg < 8);
+
+    /* B8+rd id, zero extending on x86_64 */
+    assert(check_space(buf, 1 + sizeof(imm)));
+    emit_u8(buf, (uint8_t) (0xB8 + reg));
+    emit_u32(buf, imm);
+}
+
+void emit_movd_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg) {
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0x7E /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x7E);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_movd_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    assert(reg < 8);
+
+    /* 0x66 0x0F 0x6E /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x6E);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
+}
+
 void emit_mov_rm_rint( assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    /* 0x89 /r, storing an int */
+    assert(check_space(buf, 3 + sizeof(int8_t)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x89);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, 0);
+}
+
+void emit_movdqa_x_rm(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg) {
     assert(reg < 8);
+
+    /* 0x66 0x0F 0x6F /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x6F);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, 0);
+}
+
+void emit_movdqu_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg) {
     assert(srcreg < 8);
 
-    if (reg == ESP) {
-        #if   defined(HOST_ARCH_X64)
-        /* REX.W 0x89 /r */
-        assert(check_space(buf, 4));
-        // emit_u8(buf, 0x48);
-        #elif defined(HOST_ARCH_IA32)
-        /* 0x89 /r */
-        assert(check_space(buf, 3));
-        #endif
+    /* 0xF3 0x0F 0x7F /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0xF3);
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x7F);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
 
-        emit_u8(buf, 0x89);
-        emit_u8(buf, (uint8_t) ((srcreg << 3) | reg));
-        emit_u8(buf, 0x24);
-    } else {
-        #if   defined(HOST_ARCH_X64)
-        /* REX.W 0x89 /r */
-        assert(check_space(buf, 3));
-        // emit_u8(buf, 0x48);
-        #elif defined(HOST_ARCH_IA32)
-        /* 0x89 /r */
-        assert(check_space(buf, 2));
-        #endif
+void emit_movdqu_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    assert(reg < 8);
 
-        emit_u8(buf, 0x89);
-        emit_u8(buf, (uint8_t) ((srcreg << 3) | reg));
-    }
+    /* 0xF3 0x0F 0x6F /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0xF3);
+    emit_rex(buf, EAX, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x6F);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
 }
 
-void emit_pop_r(        assembler_buffer_t * buf, asm_register_t reg) {
+void emit_movq_rmdisp_x(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg) {
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0xD6 /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xD6);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_movq_x_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp) {
     assert(reg < 8);
 
-    /* 58+rd */
-    assert(check_space(buf, 1));
-    emit_u8(buf, (uint8_t) (0x58 + reg));
+    /* 0xF3 0x0F 0x7E /r */
+    assert(check_space(buf, 5 + sizeof(int32_t)));
+    emit_u8(buf, 0xF3);
+    emit_rex(buf, EAX, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x7E);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
 }
 
-void emit_push_r(       assembler_buffer_t * buf, asm_register_t reg) {
+void emit_movzx_r_rm8disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    /* 0x0F 0xB6 /r, zero extending to all of reg */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, reg, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xB6);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
+}
+
+void emit_movzx_r_rm16disp(assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    /* 0x0F 0xB7 /r, zero extending to all of reg */
+    assert(check_space(buf, 5 + sizeof(disp)));
+    emit_rex(buf, reg, srcreg);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xB7);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
+}
+
+void emit_neg_r(        assembler_buffer_t * buf, asm_register_t reg) {
     assert(reg < 8);
 
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0xF7 /3 */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0xF7 /3 */
+    assert(check_space(buf, 2));
+    #endif
+
+    emit_u8(buf, 0xF7);
+    emit_u8(buf, (uint8_t) (0xD8 | reg));
+}
+
+void emit_paddb_x_label(assembler_buffer_t * buf, asm_xmm_register_t reg, label_t * lab) {
+    assert(reg < 8);
+
+    /* 0x66 0x0F 0xFC /r */
+    assert(check_space(buf, 4 + sizeof(int32_t)));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xFC);
+    emit_modrm_label(buf, (uint8_t) reg, lab);
+}
+
+void emit_pcmpeqb_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0x74 /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x74);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_pcmpeqd_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0x76 /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x76);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_pcmpeqw_x_x(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0x75 /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x75);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_pmovmskb_r_x( assembler_buffer_t * buf, asm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0xD7 /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xD7);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_pop_r(        assembler_buffer_t * buf, asm_register_t reg) {
+    /* 58+rd */
+    assert(check_space(buf, 2));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, (uint8_t) (0x58 + (reg & 7)));
+}
+
+void emit_push_r(       assembler_buffer_t * buf, asm_register_t reg) {
     /* 50+rd */
-    assert(check_space(buf, 1));
-    emit_u8(buf, (uint8_t) (0x50 + reg));
+    assert(check_space(buf, 2));
+    emit_rex(buf, EAX, reg);
+    emit_u8(buf, (uint8_t) (0x50 + (reg & 7)));
 }
 
 void emit_push_label(   assembler_buffer_t * buf, struct label * lab) {
     assert(buf);
     assert(lab);
+    if (buf->failed) {
+        /* The buffer is refused, and the placeholder may be pushed again. */
+        return;
+    }
     assert(!(lab->resolved));
 
-    /* Resolve */
-    lab->ptr        = ((char *) buf->buffer) + buf->offset;
+    /* Resolve, leaving the displacements to finalize_assembler_buffer */
+    lab->offset     = buf->offset;
+    lab->slack      = buf->slack;
     lab->resolved   = 1u;
 
-    /* Resolve the unresolved */
-    while (lab->sources) {
-        /* Pop */
-        struct source * src = lab->sources;
-        lab->sources = src->next;
-
-        uint8_t * next_inst = (uint8_t *) src->ptr + sizeof(int32_t);
-        uint8_t * dest_inst = (uint8_t *) lab->ptr;
-        int32_t offset = (int32_t) (dest_inst - next_inst);
-        *(src->ptr) = offset; 
-        free(src);
-    }
-
     /* Link into the assembler_buffer_t to take ownership */
     lab->next = buf->labels;
     buf->labels = lab;
 }
 
+void emit_pxor_x_x(     assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* 0x66 0x0F 0xEF /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0x66);
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xEF);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
 void emit_ret(          assembler_buffer_t * buf) {
     assert(check_space(buf, 1));
 
@@ -542,6 +1839,49 @@ void emit_ret(          assembler_buffer_t * buf) {
     emit_u8(buf, 0xC3);
 }
 
+void emit_rol_r_cl(     assembler_buffer_t * buf, asm_register_t reg) {
+    assert(reg < 8);
+
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0xD3 /0 */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0xD3 /0 */
+    assert(check_space(buf, 2));
+    #endif
+
+    emit_u8(buf, 0xD3);
+    emit_u8(buf, (uint8_t) (0xC0 | reg));
+}
+
+void emit_setne_r8(     assembler_buffer_t * buf, asm_register_t reg) {
+    /* Without a REX prefix, only AL through BL are addressable. */
+    assert(reg < 4);
+
+    /* 0x0F 0x95 /0 */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0x95);
+    emit_u8(buf, (uint8_t) (0xC0 | reg));
+}
+
+void emit_shl_r_cl(     assembler_buffer_t * buf, asm_register_t reg) {
+    assert(reg < 8);
+
+    #if   defined(HOST_ARCH_X64)
+    /* REX.W 0xD3 /4 */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0xD3 /4 */
+    assert(check_space(buf, 2));
+    #endif
+
+    emit_u8(buf, 0xD3);
+    emit_u8(buf, (uint8_t) (0xE0 | reg));
+}
+
 void emit_sub_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t imm) {
     assert(reg < 8);
 
@@ -573,6 +1913,217 @@ void emit_sub_r_immz32(assembler_buffer_t * buf, asm_register_t reg, uint32_t im
     }
 }
 
+void emit_sub_r8_r8(    assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(is_byte_register(reg));
+    assert(is_byte_register(srcreg));
+
+    /* 0x28 /r */
+    assert(check_space(buf, 3));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x28);
+    emit_u8(buf, (uint8_t) (0xC0 | ((srcreg & 7) << 3) | (reg & 7)));
+}
+
+void emit_sub_rm8disp_r8(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    assert(is_byte_register(srcreg));
+
+    /* 0x28 /r */
+    assert(check_space(buf, 3 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x28);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_sub_rm16disp_r16(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x66 0x29 /r */
+    assert(check_space(buf, 5 + sizeof(disp)));
+    emit_u8(buf, 0x66);
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x29);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_sub_rm32disp_r32(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_register_t srcreg) {
+    /* 0x29 /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_rex(buf, srcreg, reg);
+    emit_u8(buf, 0x29);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_tzcnt_r_r(     assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    #if   defined(HOST_ARCH_X64)
+    /* 0xF3 REX.W 0x0F 0xBC /r */
+    assert(check_space(buf, 5));
+    emit_u8(buf, 0xF3);
+    emit_u8(buf, 0x48);
+    #elif defined(HOST_ARCH_IA32)
+    /* 0xF3 0x0F 0xBC /r */
+    assert(check_space(buf, 4));
+    emit_u8(buf, 0xF3);
+    #endif
+
+    emit_u8(buf, 0x0F);
+    emit_u8(buf, 0xBC);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_vmovdqa_y_rm( assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+
+    /* VEX.256.66.0F 0x6F /r */
+    assert(check_space(buf, 4 + sizeof(int32_t)));
+    emit_vex256_66(buf, XMM0, srcreg);
+    emit_u8(buf, 0x6F);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, 0);
+}
+
+void emit_vmovdqa64_z_rm(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg) {
+    assert(reg < 8);
+
+    /* EVEX.512.66.0F.W1 0x6F /r */
+    assert(check_space(buf, 6 + sizeof(int32_t)));
+    emit_evex512(buf, 0x01, 1u, XMM0, srcreg);
+    emit_u8(buf, 0x6F);
+    emit_modrm_zmm(buf, (uint8_t) reg, srcreg, 0);
+}
+
+void emit_vmovdqu_rmdisp_y(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg) {
+    assert(srcreg < 8);
+
+    /* VEX.256.F3.0F 0x7F /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_vex256_f3(buf, XMM0, reg);
+    emit_u8(buf, 0x7F);
+    emit_modrm_disp(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_vmovdqu_y_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    assert(reg < 8);
+
+    /* VEX.256.F3.0F 0x6F /r */
+    assert(check_space(buf, 4 + sizeof(disp)));
+    emit_vex256_f3(buf, XMM0, srcreg);
+    emit_u8(buf, 0x6F);
+    emit_modrm_disp(buf, (uint8_t) reg, srcreg, disp);
+}
+
+void emit_vmovdqu64_rmdisp_z(assembler_buffer_t * buf, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg) {
+    assert(srcreg < 8);
+
+    /* EVEX.512.F3.0F.W1 0x7F /r */
+    assert(check_space(buf, 6 + sizeof(disp)));
+    emit_evex512(buf, 0x02, 1u, XMM0, reg);
+    emit_u8(buf, 0x7F);
+    emit_modrm_zmm(buf, (uint8_t) srcreg, reg, disp);
+}
+
+void emit_vmovdqu64_z_rmdisp(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp) {
+    assert(reg < 8);
+
+    /* EVEX.512.F3.0F.W1 0x6F /r */
+    assert(check_space(buf, 6 + sizeof(disp)));
+    emit_evex512(buf, 0x02, 1u, XMM0, srcreg);
+    emit_u8(buf, 0x6F);
+    emit_modrm_zmm(buf, (uint8_t) reg, srcreg, disp);
+}
+
+void emit_vpaddb_y_y_label(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, label_t * lab) {
+    assert(reg < 8);
+
+    /* VEX.256.66.0F 0xFC /r */
+    assert(check_space(buf, 4 + sizeof(int32_t)));
+    emit_vex256_66(buf, srcreg1, EAX);
+    emit_u8(buf, 0xFC);
+    emit_modrm_label(buf, (uint8_t) reg, lab);
+}
+
+void emit_vpaddb_z_z_label(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, label_t * lab) {
+    assert(reg < 8);
+
+    /* EVEX.512.66.0F.WIG 0xFC /r, whose disp32 is not scaled */
+    assert(check_space(buf, 6 + sizeof(int32_t)));
+    emit_evex512(buf, 0x01, 0u, srcreg1, EAX);
+    emit_u8(buf, 0xFC);
+    emit_modrm_label(buf, (uint8_t) reg, lab);
+}
+
+void emit_vpcmpeqb_k_z_z(assembler_buffer_t * buf, asm_mask_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2) {
+    assert(srcreg2 < 8);
+
+    /* EVEX.512.66.0F.WIG 0x74 /r */
+    assert(check_space(buf, 6));
+    emit_evex512(buf, 0x01, 0u, srcreg1, EAX);
+    emit_u8(buf, 0x74);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg2));
+}
+
+void emit_vpcmpeqd_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2) {
+    assert(reg < 8);
+    assert(srcreg2 < 8);
+
+    /* VEX.256.66.0F 0x76 /r */
+    assert(check_space(buf, 4));
+    emit_vex256_66(buf, srcreg1, EAX);
+    emit_u8(buf, 0x76);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg2));
+}
+
+void emit_vpcmpeqw_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2) {
+    assert(reg < 8);
+    assert(srcreg2 < 8);
+
+    /* VEX.256.66.0F 0x75 /r */
+    assert(check_space(buf, 4));
+    emit_vex256_66(buf, srcreg1, EAX);
+    emit_u8(buf, 0x75);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg2));
+}
+
+void emit_vpcmpeqb_y_y_y(assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2) {
+    assert(reg < 8);
+    assert(srcreg2 < 8);
+
+    /* VEX.256.66.0F 0x74 /r */
+    assert(check_space(buf, 4));
+    emit_vex256_66(buf, srcreg1, EAX);
+    emit_u8(buf, 0x74);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg2));
+}
+
+void emit_vpmovmskb_r_y(assembler_buffer_t * buf, asm_register_t reg, asm_xmm_register_t srcreg) {
+    assert(reg < 8);
+    assert(srcreg < 8);
+
+    /* VEX.256.66.0F 0xD7 /r */
+    assert(check_space(buf, 4));
+    emit_vex256_66(buf, XMM0, EAX);
+    emit_u8(buf, 0xD7);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg));
+}
+
+void emit_vpxor_y_y_y(  assembler_buffer_t * buf, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2) {
+    assert(reg < 8);
+    assert(srcreg2 < 8);
+
+    /* VEX.256.66.0F 0xEF /r */
+    assert(check_space(buf, 4));
+    emit_vex256_66(buf, srcreg1, EAX);
+    emit_u8(buf, 0xEF);
+    emit_u8(buf, (uint8_t) (0xC0 | (reg << 3) | srcreg2));
+}
+
+void emit_vzeroupper(   assembler_buffer_t * buf) {
+    /* VEX.128.0F 0x77 */
+    assert(check_space(buf, 3));
+    emit_u8(buf, 0xC5);
+    emit_u8(buf, 0xF8);
+    emit_u8(buf, 0x77);
+}
+
 void emit_xor_r_r(  assembler_buffer_t * buf, asm_register_t reg, asm_register_t srcreg) {
     assert(reg < 8);
     assert(srcreg < 8);
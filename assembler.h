@@ -20,6 +20,7 @@
 #define __BF__ASSEMBLER_H__
 
 #include "constants.h"
+#include <stddef.h>
 #include <stdint.h>
 
 typedef void* assembler_buffer_t;
@@ -29,32 +30,118 @@ assembler_buffer_t new_assembler_buffer(void);
 void * finalize_assembler_buffer(assembler_buffer_t);
 void delete_assembler_buffer(assembler_buffer_t);
 
-label_t new_label(void);
-void delete_label(label_t);
+/*
+ * Returns nonzero if finalize_assembler_buffer refused the buffer because
+ * memory for its bookkeeping ran out, rather than a mapping.
+ */
+int is_out_of_memory(assembler_buffer_t);
+
+/* Labels are owned by, and deleted along with, their buffer. */
+label_t new_label(assembler_buffer_t);
 
 void emit_add_rm8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
+void emit_add_rm8disp_imm8(assembler_buffer_t, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_add_rm8disp_r8(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_add_rm16disp_imm16(assembler_buffer_t, asm_register_t reg, int32_t disp, uint16_t imm);
+void emit_add_rm16disp_r16(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_add_rm32disp_imm32(assembler_buffer_t, asm_register_t reg, int32_t disp, uint32_t imm);
+void emit_add_rm32disp_r32(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_add_r8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
+void emit_add_r8_r8(    assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_add_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
 void emit_add_r_immz32( assembler_buffer_t, asm_register_t reg, uint32_t imm);
 void emit_and_r_immz32( assembler_buffer_t, asm_register_t reg, uint32_t imm);
+void emit_and_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_align(        assembler_buffer_t, size_t alignment);
+void emit_bsf_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_bsr_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
 void emit_call(         assembler_buffer_t, uintptr_t imm);
+void emit_call_label(   assembler_buffer_t, label_t lab);
+void emit_cmp_r8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
 void emit_cmp_rm8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
+void emit_cmp_rm8disp_imm8(assembler_buffer_t, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_cmp_rm16disp_imm8(assembler_buffer_t, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_cmp_rm32disp_imm8(assembler_buffer_t, asm_register_t reg, int32_t disp, uint8_t imm);
 void emit_cmp_r_immz32( assembler_buffer_t, asm_register_t reg, uint32_t imm);
 void emit_cmp_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_data(         assembler_buffer_t, const void * data, size_t size);
+void emit_div_r(        assembler_buffer_t, asm_register_t reg);
+void emit_imul_r_r(     assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_imul_r_r_imm8(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, uint8_t imm);
+void emit_imul_r_r_imm32(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, uint32_t imm);
 void emit_je(           assembler_buffer_t, label_t lab);
+void emit_jg(           assembler_buffer_t, label_t lab);
 void emit_jle(          assembler_buffer_t, label_t lab);
 void emit_jmp(          assembler_buffer_t, label_t lab);
+void emit_jmp_r(        assembler_buffer_t, asm_register_t reg);
 void emit_jne(          assembler_buffer_t, label_t lab);
+void emit_kmovq_r_k(     assembler_buffer_t, asm_register_t reg, asm_mask_register_t srcreg);
+void emit_kortestq_k_k( assembler_buffer_t, asm_mask_register_t reg, asm_mask_register_t srcreg);
+void emit_lea_r_rmdisp( assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_lea_r_rmindex(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, asm_register_t index, uint8_t scale, int32_t disp);
 void emit_leave(        assembler_buffer_t);
+void emit_mov_r8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
+void emit_mov_r8_r8(    assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
 void emit_mov_r8_rm8(   assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_mov_r8_rm8disp(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_mov_rm8_imm8( assembler_buffer_t, asm_register_t reg, uint8_t imm);
 void emit_mov_rm8_r8(   assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_mov_rm8disp_imm8(assembler_buffer_t, asm_register_t reg, int32_t disp, uint8_t imm);
+void emit_mov_rm8disp_r8(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_mov_rm16disp_imm16(assembler_buffer_t, asm_register_t reg, int32_t disp, uint16_t imm);
+void emit_mov_rm16disp_r16(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_mov_rm32disp_imm32(assembler_buffer_t, asm_register_t reg, int32_t disp, uint32_t imm);
+void emit_mov_rm32disp_r32(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_mov_r32_rm32disp(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, int32_t disp);
 void emit_mov_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
 void emit_mov_r_immptr( assembler_buffer_t, asm_register_t reg, uintptr_t imm);
+void emit_mov_r_imm32(  assembler_buffer_t, asm_register_t reg, uint32_t imm);
+void emit_movd_rmdisp_x(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg);
+void emit_movd_x_rmdisp(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp);
 void emit_mov_rm_rint(  assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_movdqa_x_rm(  assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg);
+void emit_movdqu_rmdisp_x(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg);
+void emit_movdqu_x_rmdisp(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_movq_rmdisp_x(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg);
+void emit_movq_x_rmdisp(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_movzx_r_rm8disp(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_movzx_r_rm16disp(assembler_buffer_t, asm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_neg_r(        assembler_buffer_t, asm_register_t reg);
+void emit_paddb_x_label(assembler_buffer_t, asm_xmm_register_t reg, label_t lab);
+void emit_pcmpeqb_x_x(  assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg);
+void emit_pcmpeqd_x_x(  assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg);
+void emit_pcmpeqw_x_x(  assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg);
+void emit_pmovmskb_r_x( assembler_buffer_t, asm_register_t reg, asm_xmm_register_t srcreg);
 void emit_pop_r(        assembler_buffer_t, asm_register_t reg);
 void emit_push_r(       assembler_buffer_t, asm_register_t reg);
 void emit_push_rint(    assembler_buffer_t, asm_register_t reg);
 void emit_push_label(   assembler_buffer_t, label_t lab);
+void emit_pxor_x_x(     assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg);
 void emit_ret(          assembler_buffer_t);
+void emit_rol_r_cl(     assembler_buffer_t, asm_register_t reg);
+void emit_setne_r8(     assembler_buffer_t, asm_register_t reg);
+void emit_shl_r_cl(     assembler_buffer_t, asm_register_t reg);
 void emit_sub_r_immz32( assembler_buffer_t, asm_register_t reg, uint32_t imm);
+void emit_sub_r8_r8(    assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_sub_rm8disp_r8(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_sub_rm16disp_r16(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_sub_rm32disp_r32(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_register_t srcreg);
+void emit_tzcnt_r_r(     assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
+void emit_vmovdqa_y_rm( assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg);
+void emit_vmovdqa64_z_rm(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg);
+void emit_vmovdqu_rmdisp_y(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg);
+void emit_vmovdqu_y_rmdisp(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_vmovdqu64_rmdisp_z(assembler_buffer_t, asm_register_t reg, int32_t disp, asm_xmm_register_t srcreg);
+void emit_vmovdqu64_z_rmdisp(assembler_buffer_t, asm_xmm_register_t reg, asm_register_t srcreg, int32_t disp);
+void emit_vpaddb_y_y_label(assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, label_t lab);
+void emit_vpaddb_z_z_label(assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, label_t lab);
+void emit_vpcmpeqb_y_y_y(assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2);
+void emit_vpcmpeqb_k_z_z(assembler_buffer_t, asm_mask_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2);
+void emit_vpcmpeqd_y_y_y(assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2);
+void emit_vpcmpeqw_y_y_y(assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2);
+void emit_vpmovmskb_r_y(assembler_buffer_t, asm_register_t reg, asm_xmm_register_t srcreg);
+void emit_vpxor_y_y_y(  assembler_buffer_t, asm_xmm_register_t reg, asm_xmm_register_t srcreg1, asm_xmm_register_t srcreg2);
+void emit_vzeroupper(   assembler_buffer_t);
 void emit_xor_r_r(      assembler_buffer_t, asm_register_t reg, asm_register_t srcreg);
 
 #endif // __BF__ASSEMBLER_H__
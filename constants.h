@@ -27,7 +27,39 @@ typedef enum register_enum {
   ESP = 4,
   EBP = 5,
   ESI = 6,
-  EDI = 7
+  EDI = 7,
+  /* x86_64 only, and only with a REX prefix. */
+  R8  = 8,
+  R9  = 9,
+  R10 = 10,
+  R11 = 11,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15
 } asm_register_t;
 
+typedef enum xmm_register_enum {
+  XMM0 = 0,
+  XMM1 = 1,
+  XMM2 = 2,
+  XMM3 = 3,
+  XMM4 = 4,
+  XMM5 = 5,
+  XMM6 = 6,
+  XMM7 = 7
+} asm_xmm_register_t;
+
+/* AVX-512 only. */
+typedef enum mask_register_enum {
+  K0 = 0,
+  K1 = 1,
+  K2 = 2,
+  K3 = 3,
+  K4 = 4,
+  K5 = 5,
+  K6 = 6,
+  K7 = 7
+} asm_mask_register_t;
+
 #endif // __BF__CONSTANTS_H__
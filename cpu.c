@@ -0,0 +1,136 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpu.h"
+#include <cpuid.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CPUID.1:ECX */
+#define CPUID_1_SSE42       (1u << 20)
+#define CPUID_1_OSXSAVE     (1u << 27)
+#define CPUID_1_AVX         (1u << 28)
+
+/* CPUID.(7,0):EBX */
+#define CPUID_7_BMI1        (1u << 3)
+#define CPUID_7_AVX2        (1u << 5)
+#define CPUID_7_BMI2        (1u << 8)
+#define CPUID_7_AVX512F     (1u << 16)
+#define CPUID_7_AVX512BW    (1u << 30)
+
+/* XCR0:  the register state the operating system saves */
+#define XCR0_YMM            0x06u
+#define XCR0_ZMM            0xE6u
+
+/* Never a valid set of features */
+#define UNDETECTED          (~0u)
+
+static unsigned xgetbv(void) {
+    uint32_t eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+}
+
+static unsigned detect_features(void) {
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 1) {
+        return 0;
+    }
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    const unsigned leaf1 = ecx;
+
+    unsigned ret = 0;
+    if (leaf1 & CPUID_1_SSE42) {
+        ret |= cpu_sse42;
+    }
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return ret;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    const unsigned leaf7 = ebx;
+
+    if ((leaf7 & CPUID_7_BMI1) && (leaf7 & CPUID_7_BMI2)) {
+        ret |= cpu_bmi;
+    }
+
+    /* Without XSAVE enabled, the upper halves of the registers are lost. */
+    if (!(leaf1 & CPUID_1_OSXSAVE) || !(leaf1 & CPUID_1_AVX)) {
+        return ret;
+    }
+
+    const unsigned xcr0 = xgetbv();
+    if ((xcr0 & XCR0_YMM) == XCR0_YMM && (leaf7 & CPUID_7_AVX2)) {
+        ret |= cpu_avx2;
+
+        if ((xcr0 & XCR0_ZMM) == XCR0_ZMM && (leaf7 & CPUID_7_AVX512F) &&
+                (leaf7 & CPUID_7_AVX512BW)) {
+            ret |= cpu_avx512bw;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Returns the tier named by BF_CPU_TIER, or cpu_tier_avx512 if it is unset.
+ * An unknown name gives cpu_tier_baseline, so a misspelled override never
+ * leaves the widest kernels enabled.
+ */
+static unsigned environment_tier(void) {
+    const char * name = getenv("BF_CPU_TIER");
+    if (!(name)) {
+        return cpu_tier_avx512;
+    } else if (strcmp(name, "avx512") == 0) {
+        return cpu_tier_avx512;
+    } else if (strcmp(name, "avx2") == 0) {
+        return cpu_tier_avx2;
+    } else if (strcmp(name, "sse4.2") == 0) {
+        return cpu_tier_sse42;
+    } else {
+        /* baseline, or a name we do not know. */
+        return cpu_tier_baseline;
+    }
+}
+
+unsigned cpu_features(void) {
+    /* Racing callers store the same value, so no lock is needed. */
+    static unsigned features = UNDETECTED;
+
+    if (features == UNDETECTED) {
+        features = detect_features() & cpu_tier_features(environment_tier());
+    }
+
+    return features;
+}
+
+unsigned cpu_tier_features(unsigned tier) {
+    switch (tier) {
+        case cpu_tier_baseline:
+            return 0;
+        case cpu_tier_sse42:
+            return cpu_sse42;
+        case cpu_tier_avx2:
+            return cpu_sse42 | cpu_avx2 | cpu_bmi;
+        default:
+            return cpu_sse42 | cpu_avx2 | cpu_bmi | cpu_avx512bw;
+    }
+}
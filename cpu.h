@@ -0,0 +1,59 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __BF__CPU_H__
+#define __BF__CPU_H__
+
+/**
+ * Instruction set extensions the code generator can use beyond the baseline
+ * (SSE2 on x86_64), as a bit set.  cpu_bmi stands for both BMI1 and BMI2.
+ */
+typedef enum cpu_feature {
+    cpu_sse42       = 1u << 0,
+    cpu_avx2        = 1u << 1,
+    cpu_bmi         = 1u << 2,
+    cpu_avx512bw    = 1u << 3
+} cpu_feature_t;
+
+/**
+ * Tiers of those features, each including those below it.  A tier caps what
+ * the code generator may use; it never enables a feature the host lacks.
+ */
+typedef enum cpu_tier {
+    cpu_tier_baseline   = 0,
+    cpu_tier_sse42      = 1,
+    cpu_tier_avx2       = 2,
+    cpu_tier_avx512     = 3
+} cpu_tier_t;
+
+/**
+ * Returns the features of the host, as found by CPUID the first time it is
+ * called.  A feature is only reported if the operating system also saves the
+ * registers it uses.
+ *
+ * If the environment variable BF_CPU_TIER is set, to baseline, sse4.2, avx2
+ * or avx512, features above that tier are dropped.  Any other value is taken
+ * as baseline.
+ */
+unsigned cpu_features(void);
+
+/**
+ * Returns the features permitted at tier.
+ */
+unsigned cpu_tier_features(unsigned tier);
+
+#endif // __BF__CPU_H__
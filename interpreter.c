@@ -21,10 +21,13 @@
  */
 #define _GNU_SOURCE
 
+#include "arena.h"
 #include "assembler.h"
 #include <assert.h>
 #include "common.h"
+#include "cpu.h"
 #include "interpreter.h"
+#include "ir.h"
 #include <setjmp.h>
 #include <signal.h>
 #include <stddef.h>
@@ -38,23 +41,20 @@
 #include <valgrind/memcheck.h>
 
 size_t allocated;
-jmp_buf env;
+sigjmp_buf env;
 size_t page_size;
 char * tape;
 
 size_t pages_forward;
 size_t pages_reverse;
 
-typedef enum op {
-    op_modify                 = '+',
-    op_right                  = '>',
-    op_left                   = '<',
-    op_get                    = ',',
-    op_put                    = '.',
-    op_if                     = '[',
-    op_endif                  = ']',
-    op_invalid                = '\0'
-} op_t;
+/* The output sinks, for put_literal, and the input source, for get_byte. */
+static putchar_t put_char;
+static putstr_t  put_str;
+static getchar_t get_char;
+
+/* The instructions examined by the loop analyses, for the tests. */
+static size_t analysis_steps;
 
 static void handler(int sig, siginfo_t * info, void * context) {
     (void) sig;
@@ -79,13 +79,13 @@ static void handler(int sig, siginfo_t * info, void * context) {
 
            if (fault >= tape     && fault < user_start) {
         /* Hit the left guard: Underflow */
-        longjmp(env, interpret_tape_underflow);
+        siglongjmp(env, interpret_tape_underflow);
     } else if (fault >= user_end && fault < real_end) {
         /* Hit the right guard:  Overflow */
-        longjmp(env, interpret_tape_exceeded);
+        siglongjmp(env, interpret_tape_exceeded);
     } else {
         /* We ran out of memory. */
-        longjmp(env, interpret_no_memory);
+        siglongjmp(env, interpret_no_memory);
     }
 }
 
@@ -95,26 +95,1843 @@ static void timer_handler(int sig, siginfo_t * info, void * context) {
     (void) context;
 
     /* We stop whenever we get an alarm. */
-    longjmp(env, interpret_time_exceeded);
+    siglongjmp(env, interpret_time_exceeded);
+}
+
+/**
+ * A run of output known at compile time.
+ */
+typedef struct literal {
+    const char * data;
+    size_t       size;
+} literal_t;
+
+/**
+ * Writes a literal, in one call to the bulk sink if there is one.  The
+ * generated code calls this with the literal as its only argument.
+ */
+static void put_literal(const literal_t * literal) {
+    if (put_str) {
+        put_str(literal->data, literal->size);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < literal->size; i++) {
+        put_char((unsigned char) literal->data[i]);
+    }
+}
+
+/**
+ * Reads a byte from the input source, or 0 at the end of the input.
+ */
+static int get_byte(void) {
+    const int c = get_char();
+    return c == EOF ? 0 : (unsigned char) c;
+}
+
+/**
+ * Emits a trampoline at label that tail calls target, if any code calls it.
+ * Each I/O call site shares one, reaching it with a 5-byte call rather than
+ * loading the address of target itself.  target returns straight to the
+ * site, with the stack as the site left it.
+ */
+static void emit_trampoline(assembler_buffer_t buffer, label_t label,
+        uintptr_t target) {
+    if (!(label)) {
+        return;
+    }
+
+    /*
+     * label:
+     * movl target, %eax
+     * jmp *%eax
+     */
+    emit_push_label(buffer, label);
+    emit_mov_r_immptr(buffer, EAX, target);
+    emit_jmp_r(buffer, EAX);
+}
+
+/**
+ * Returns nonzero for instructions that a run of op_prints may span.  They
+ * only move the pointer, so cannot fault on the guard pages, and the run may
+ * be written all at once, where it starts.  The run ends at the first
+ * instruction that touches the tape, lest output that follows a faulting
+ * access be written ahead of it.
+ */
+static int is_print_run(op_t op) {
+    switch (op) {
+        case op_print:
+        case op_right:
+        case op_left:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Emits the run of op_prints starting at op as one call, gathering its bytes
+ * into literal, whose data is data, and returns the instruction after the
+ * run.  The run never reaches past the resume point, where the generated
+ * code may start.  A lone byte is passed straight to the putchar trampoline,
+ * as for op_put.  Either trampoline is created along with its first call.
+ */
+static size_t emit_print(assembler_buffer_t buffer, const program_t * program,
+        size_t op, size_t resume, literal_t * literal, char * data,
+        label_t * put_trampoline, label_t * literal_trampoline) {
+    const instruction_t * instructions = program->instructions;
+
+    literal->data = data;
+    literal->size = 0;
+
+    size_t end;
+    for (end = op; end < program->count && is_print_run(instructions[end].op) &&
+            (end == op || end != resume); end++) {
+        if (instructions[end].op == op_print) {
+            data[literal->size++] = (char) instructions[end].val;
+        }
+    }
+
+    /*
+     * movl literal, %edi (x86_64) / movl literal, (%esp) (ia32)
+     * call literal
+     */
+    label_t * target =
+        literal->size == 1 ? put_trampoline : literal_trampoline;
+
+    #if   defined(HOST_ARCH_X64)
+    if (literal->size == 1) {
+        emit_mov_r_imm32(buffer, EDI, (uint8_t) instructions[op].val);
+    } else {
+        emit_mov_r_immptr(buffer, EDI, (uintptr_t) literal);
+    }
+    #elif defined(HOST_ARCH_IA32)
+    emit_mov_r_immptr(buffer, EAX, literal->size == 1 ?
+        (uint8_t) instructions[op].val : (uintptr_t) literal);
+    emit_mov_rm_rint(buffer, ESP, EAX);
+    #else
+    #error Unsupported architecture.
+    #endif
+
+    if (!(*target)) {
+        *target = new_label(buffer);
+    }
+    emit_call_label(buffer, *target);
+
+    return end;
+}
+
+typedef struct link {
+    size_t   offset;
+    struct link * previous;
+} link_t;
+
+/**
+ * The labels of a loop.  head is only created for regions entered from a
+ * guard, and stub and after only for loops outlined into a stub.
+ */
+typedef struct branch {
+    label_t head;
+    label_t top;
+    label_t end;
+    label_t stub;
+    label_t after;
+} branch_t;
+
+/**
+ * A clamp of the pointer register to the start of the tape, emitted after the
+ * code.  Moving left off the tape is rare, so the inline code only tests for
+ * it and branches here.  A clamped scan then spins on the first cell, as the
+ * byte-wise loop would have, before the code resumes.
+ */
+typedef struct clamp {
+    label_t        label;
+    label_t        resume;
+    asm_register_t reg;
+    int            spin;
+    int            vzeroupper;
+} clamp_t;
+
+/**
+ * Returns nonzero if no loop nests within loop, though cold regions may.  The
+ * tops of these loops, run the most often for the least code, start a fresh
+ * 16-byte fetch block; the nops before them only run on entry.
+ */
+static int is_innermost(const program_t * program, size_t loop) {
+    size_t inner;
+    for (inner = loop + 1; inner < program->loop_count &&
+            program->loops[inner].open < program->loops[loop].close; inner++) {
+        if (program->instructions[program->loops[inner].open].op != op_cold) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Compares the pointer register against an absolute address.
+ */
+static void emit_cmp_ptr(assembler_buffer_t buffer, asm_register_t reg,
+        uintptr_t value) {
+    if (sizeof(uintptr_t) == sizeof(uint32_t)) {
+        emit_cmp_r_immz32(buffer, reg, (uint32_t) value);
+    } else {
+        /* x86_64 does not let us directly compare a register with a 64-bit
+         * immediate, so we stash the value in RDI and compare from there. */
+        emit_mov_r_immptr(buffer, EDI, value);
+        emit_cmp_r_r(buffer, reg, EDI);
+    }
+}
+
+/*
+ * The code generators for each width of cell.  Each operates on the cell of
+ * cell_size bytes at disp(%reg), with the 8, 16 or 32-bit form of the same
+ * instruction.
+ */
+
+/* Returns the displacement of the cell offset cells from the pointer. */
+static int32_t cell_disp(ptrdiff_t offset, unsigned cell_size) {
+    return (int32_t) (offset * (ptrdiff_t) cell_size);
+}
+
+/* add imm, disp(%reg) */
+static void emit_cell_add_imm(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp, uint32_t imm) {
+    switch (cell_size) {
+        case 1:
+            emit_add_rm8disp_imm8(buffer, reg, disp, (uint8_t) imm);
+            break;
+        case 2:
+            emit_add_rm16disp_imm16(buffer, reg, disp, (uint16_t) imm);
+            break;
+        default:
+            emit_add_rm32disp_imm32(buffer, reg, disp, imm);
+            break;
+    }
+}
+
+/* add %sreg, disp(%reg) */
+static void emit_cell_add_r(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp, asm_register_t sreg) {
+    switch (cell_size) {
+        case 1:
+            emit_add_rm8disp_r8(buffer, reg, disp, sreg);
+            break;
+        case 2:
+            emit_add_rm16disp_r16(buffer, reg, disp, sreg);
+            break;
+        default:
+            emit_add_rm32disp_r32(buffer, reg, disp, sreg);
+            break;
+    }
+}
+
+/* sub %sreg, disp(%reg) */
+static void emit_cell_sub_r(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp, asm_register_t sreg) {
+    switch (cell_size) {
+        case 1:
+            emit_sub_rm8disp_r8(buffer, reg, disp, sreg);
+            break;
+        case 2:
+            emit_sub_rm16disp_r16(buffer, reg, disp, sreg);
+            break;
+        default:
+            emit_sub_rm32disp_r32(buffer, reg, disp, sreg);
+            break;
+    }
+}
+
+/* cmp 0, disp(%reg) */
+static void emit_cell_cmp_zero(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp) {
+    switch (cell_size) {
+        case 1:
+            emit_cmp_rm8disp_imm8(buffer, reg, disp, 0);
+            break;
+        case 2:
+            emit_cmp_rm16disp_imm8(buffer, reg, disp, 0);
+            break;
+        default:
+            emit_cmp_rm32disp_imm8(buffer, reg, disp, 0);
+            break;
+    }
+}
+
+/* mov imm, disp(%reg) */
+static void emit_cell_store_imm(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp, uint32_t imm) {
+    switch (cell_size) {
+        case 1:
+            emit_mov_rm8disp_imm8(buffer, reg, disp, (uint8_t) imm);
+            break;
+        case 2:
+            emit_mov_rm16disp_imm16(buffer, reg, disp, (uint16_t) imm);
+            break;
+        default:
+            emit_mov_rm32disp_imm32(buffer, reg, disp, imm);
+            break;
+    }
+}
+
+/* mov %sreg, disp(%reg) */
+static void emit_cell_store_r(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t reg, int32_t disp, asm_register_t sreg) {
+    switch (cell_size) {
+        case 1:
+            emit_mov_rm8disp_r8(buffer, reg, disp, sreg);
+            break;
+        case 2:
+            emit_mov_rm16disp_r16(buffer, reg, disp, sreg);
+            break;
+        default:
+            emit_mov_rm32disp_r32(buffer, reg, disp, sreg);
+            break;
+    }
+}
+
+/*
+ * mov disp(%reg), %dreg, into its low bits.  Wider cells are zero extended;
+ * the rest of dreg is left as it was for bytes.
+ */
+static void emit_cell_load_r(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t dreg, asm_register_t reg, int32_t disp) {
+    switch (cell_size) {
+        case 1:
+            emit_mov_r8_rm8disp(buffer, dreg, reg, disp);
+            break;
+        case 2:
+            emit_movzx_r_rm16disp(buffer, dreg, reg, disp);
+            break;
+        default:
+            emit_mov_r32_rm32disp(buffer, dreg, reg, disp);
+            break;
+    }
+}
+
+/* imul factor, %sreg, %dreg, the low cell_size bytes of which are kept */
+static void emit_cell_imul(assembler_buffer_t buffer, unsigned cell_size,
+        asm_register_t dreg, asm_register_t sreg, uint32_t factor) {
+    if (cell_size == 1) {
+        emit_imul_r_r_imm8(buffer, dreg, sreg, (uint8_t) factor);
+    } else {
+        emit_imul_r_r_imm32(buffer, dreg, sreg, factor);
+    }
+}
+
+#if defined(HOST_ARCH_X64)
+/* pcmpeqb %xmm0, %xmm1, or pcmpeqw or pcmpeqd, one cell at a time */
+static void emit_pcmpeq_cells(assembler_buffer_t buffer, unsigned cell_size) {
+    switch (cell_size) {
+        case 1:
+            emit_pcmpeqb_x_x(buffer, XMM1, XMM0);
+            break;
+        case 2:
+            emit_pcmpeqw_x_x(buffer, XMM1, XMM0);
+            break;
+        default:
+            emit_pcmpeqd_x_x(buffer, XMM1, XMM0);
+            break;
+    }
+}
+
+/* vpcmpeqb %ymm0, %ymm1, %ymm1, or vpcmpeqw or vpcmpeqd */
+static void emit_vpcmpeq_cells(assembler_buffer_t buffer, unsigned cell_size) {
+    switch (cell_size) {
+        case 1:
+            emit_vpcmpeqb_y_y_y(buffer, XMM1, XMM1, XMM0);
+            break;
+        case 2:
+            emit_vpcmpeqw_y_y_y(buffer, XMM1, XMM1, XMM0);
+            break;
+        default:
+            emit_vpcmpeqd_y_y_y(buffer, XMM1, XMM1, XMM0);
+            break;
+    }
+}
+#endif
+
+/**
+ * Moves the pointer register left by val bytes, clamping at the start of the
+ * tape through clamp.
+ */
+static void emit_left(assembler_buffer_t buffer, asm_register_t reg,
+        char * tape_start, ptrdiff_t val, clamp_t * clamp) {
+    /* cmpl imm, %ptrreg
+     * jle clamp
+     * leal -imm(%ptrreg), %ptrreg
+     * resume:
+     */
+    clamp->label  = new_label(buffer);
+    clamp->resume = new_label(buffer);
+    clamp->reg    = reg;
+
+    uintptr_t min_value = (uintptr_t) (tape_start + val);
+    emit_cmp_ptr(buffer, reg, min_value);
+
+    emit_jle(buffer, clamp->label);
+    emit_lea_r_rmdisp(buffer, reg, reg, (int32_t) -val);
+    emit_push_label(buffer, clamp->resume);
+}
+
+/**
+ * Emits a loop moving the pointer register by stride until it reaches a zero
+ * cell.
+ *
+ * On x86_64, steps of 1, 2 and 4 bytes test an aligned block of 16 (SSE2), 32
+ * (AVX2) or 64 (AVX-512BW) bytes at a time, as features allows, masking out
+ * the cells the loop would step over.  An aligned load never straddles a
+ * page, so a forward scan faults on the right guard page exactly when the
+ * cell-wise loop would have.  A backward scan never loads below the first
+ * block of the tape; once that is exhausted, the pointer clamps at the start
+ * of the tape, through clamp, just as '<' would.
+ *
+ * Cells of 2 and 4 bytes are compared a word or doubleword at a time, setting
+ * the bits of each of their bytes in the byte mask, of which the mask of the
+ * cells visited keeps the first.  AVX-512 compares only give a bit per cell,
+ * so they are left to bytes.
+ */
+static void emit_scan(assembler_buffer_t buffer, asm_register_t reg,
+        char * tape_start, ptrdiff_t stride, clamp_t * clamp,
+        unsigned features, unsigned cell_size) {
+    label_t end = new_label(buffer);
+    const ptrdiff_t step = stride * (ptrdiff_t) cell_size;
+
+    /*
+     * cmp r/m 0
+     * je end
+     */
+    emit_cell_cmp_zero(buffer, cell_size, reg, 0);
+    emit_je(buffer, end);
+
+    #if defined(HOST_ARCH_X64)
+    const ptrdiff_t distance = step < 0 ? -step : step;
+    if (distance == 1 || distance == 2 || distance == 4) {
+        /* The cells visited, replicated across a 64-bit mask. */
+        const uint64_t pattern =
+            distance == 1 ? UINT64_C(0xFFFFFFFFFFFFFFFF) :
+            distance == 2 ? UINT64_C(0x5555555555555555) :
+                            UINT64_C(0x1111111111111111);
+        const uint32_t block =
+            (features & cpu_avx512bw) && cell_size == 1 ? 64u :
+            (features & cpu_avx2)                       ? 32u : 16u;
+
+        label_t loop  = new_label(buffer);
+        label_t found = new_label(buffer);
+
+        /*
+         * pxor %xmm0, %xmm0
+         * movq %ptrreg, %rcx
+         * andq block - 1, %rcx
+         * movabsq pattern, %rsi
+         * rolq %cl, %rsi
+         *
+         * The VEX encoded vpxor clears all of %zmm0 for AVX-512.
+         */
+        if (block >= 32u) {
+            emit_vpxor_y_y_y(buffer, XMM0, XMM0, XMM0);
+        } else {
+            emit_pxor_x_x(buffer, XMM0, XMM0);
+        }
+        emit_mov_r_r(buffer, ECX, reg);
+        emit_and_r_immz32(buffer, ECX, block - 1u);
+        emit_mov_r_immptr(buffer, ESI, (uintptr_t) pattern);
+        emit_rol_r_cl(buffer, ESI);
+
+        /*
+         * Mask off the current cell and those behind it in the first block.
+         *
+         * forward:             backward:
+         * movabsq -2, %rdx     movl 1, %edx
+         * shlq %cl, %rdx       shlq %cl, %rdx
+         *                      subq 1, %rdx
+         * andq %rsi, %rdx      andq %rsi, %rdx
+         */
+        if (stride > 0) {
+            emit_mov_r_immptr(buffer, EDX, ~(uintptr_t) 1u);
+        } else {
+            emit_mov_r_imm32(buffer, EDX, 1u);
+        }
+        emit_shl_r_cl(buffer, EDX);
+        if (stride < 0) {
+            emit_sub_r_immz32(buffer, EDX, 1u);
+        }
+        emit_and_r_r(buffer, EDX, ESI);
+
+        /*
+         * movq %ptrreg, %rax
+         * andq -block, %rax
+         * loop:
+         * movdqa (%rax), %xmm1
+         * pcmpeqb %xmm0, %xmm1 (pcmpeqw, pcmpeqd)
+         * pmovmskb %xmm1, %ecx
+         * andq %rdx, %rcx
+         * jne found
+         *
+         * AVX-512BW compares into %k1 and moves all 64 bits of it to %rcx.
+         */
+        emit_mov_r_r(buffer, EAX, reg);
+        emit_and_r_immz32(buffer, EAX, ~(block - 1u));
+        if (stride < 0) {
+            emit_mov_r_immptr(buffer, EDI, (uintptr_t) tape_start);
+        }
+        emit_push_label(buffer, loop);
+        if (block == 64u) {
+            emit_vmovdqa64_z_rm(buffer, XMM1, EAX);
+            emit_vpcmpeqb_k_z_z(buffer, K1, XMM1, XMM0);
+            emit_kmovq_r_k(buffer, ECX, K1);
+        } else if (block == 32u) {
+            emit_vmovdqa_y_rm(buffer, XMM1, EAX);
+            emit_vpcmpeq_cells(buffer, cell_size);
+            emit_vpmovmskb_r_y(buffer, ECX, XMM1);
+        } else {
+            emit_movdqa_x_rm(buffer, XMM1, EAX);
+            emit_pcmpeq_cells(buffer, cell_size);
+            emit_pmovmskb_r_x(buffer, ECX, XMM1);
+        }
+        emit_and_r_r(buffer, ECX, EDX);
+        emit_jne(buffer, found);
+
+        if (stride > 0) {
+            /*
+             * addq block, %rax
+             */
+            emit_add_r_immz32(buffer, EAX, block);
+        } else {
+            /*
+             * cmpq %rdi, %rax
+             * jle clamp
+             * subq block, %rax
+             */
+            clamp->label      = new_label(buffer);
+            clamp->resume     = end;
+            clamp->reg        = reg;
+            clamp->spin       = 1;
+            clamp->vzeroupper = block >= 32u;
+
+            emit_cmp_r_r(buffer, EAX, EDI);
+            emit_jle(buffer, clamp->label);
+            emit_sub_r_immz32(buffer, EAX, block);
+        }
+
+        /*
+         * movl %esi, %edx
+         * jmp loop
+         * found:
+         * bsf/bsr %rcx, %rcx
+         * addq %rcx, %rax
+         * movq %rax, %ptrreg
+         *
+         * With BMI, tzcnt stands in for bsf, which is slow on some parts.
+         */
+        emit_mov_r_r(buffer, EDX, ESI);
+        emit_jmp(buffer, loop);
+        emit_push_label(buffer, found);
+        if (stride < 0) {
+            emit_bsr_r_r(buffer, ECX, ECX);
+        } else if (features & cpu_bmi) {
+            emit_tzcnt_r_r(buffer, ECX, ECX);
+        } else {
+            emit_bsf_r_r(buffer, ECX, ECX);
+        }
+        emit_add_r_r(buffer, EAX, ECX);
+        emit_mov_r_r(buffer, reg, EAX);
+        if (block >= 32u) {
+            emit_vzeroupper(buffer);
+        }
+
+        emit_push_label(buffer, end);
+        return;
+    }
+    #endif
+
+    /*
+     * top:
+     * addl step, %ptrreg (or the clamping subtraction)
+     * cmp r/m 0
+     * jne top
+     * end:
+     */
+    label_t top = new_label(buffer);
+    emit_push_label(buffer, top);
+    if (step > 0) {
+        emit_add_r_immz32(buffer, reg, (uint32_t) step);
+    } else {
+        emit_left(buffer, reg, tape_start, -step, clamp);
+    }
+    emit_cell_cmp_zero(buffer, cell_size, reg, 0);
+    emit_jne(buffer, top);
+    emit_push_label(buffer, end);
+}
+
+/**
+ * The addends of a vector add, emitted after the code.
+ */
+typedef struct vector_constant {
+    label_t label;
+    uint8_t bytes[64];
+} vector_constant_t;
+
+#if defined(HOST_ARCH_X64)
+/**
+ * Emits the op_vadd at op, adding the op_lanes that follow it to its window
+ * of cells at once.  The lanes are gathered into constant, which is emitted
+ * after the code.  Narrower windows use movd or movq, and 32 and 64-cell
+ * windows use the AVX2 and AVX-512BW equivalents.
+ *
+ * movdqu offset(%ptrreg), %xmm0
+ * paddb constant(%rip), %xmm0
+ * movdqu %xmm0, offset(%ptrreg)
+ */
+static void emit_vadd(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t op, vector_constant_t * constant) {
+    const instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+
+    constant->label = new_label(buffer);
+
+    size_t lane;
+    for (lane = op + 1; lane < op_count &&
+            instructions[lane].op == op_lane; lane++) {
+        const ptrdiff_t at =
+            instructions[lane].offset - instructions[op].offset;
+        assert(at >= 0 && at < instructions[op].val);
+        constant->bytes[at] = (uint8_t) instructions[lane].val;
+    }
+
+    const int32_t offset = (int32_t) instructions[op].offset;
+    switch (instructions[op].val) {
+        case 4:
+            emit_movd_x_rmdisp(buffer, XMM0, reg, offset);
+            emit_paddb_x_label(buffer, XMM0, constant->label);
+            emit_movd_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 8:
+            emit_movq_x_rmdisp(buffer, XMM0, reg, offset);
+            emit_paddb_x_label(buffer, XMM0, constant->label);
+            emit_movq_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 16:
+            emit_movdqu_x_rmdisp(buffer, XMM0, reg, offset);
+            emit_paddb_x_label(buffer, XMM0, constant->label);
+            emit_movdqu_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 32:
+            emit_vmovdqu_y_rmdisp(buffer, XMM0, reg, offset);
+            emit_vpaddb_y_y_label(buffer, XMM0, XMM0, constant->label);
+            emit_vmovdqu_rmdisp_y(buffer, reg, offset, XMM0);
+
+            /* Consecutive windows share the vzeroupper. */
+            if (lane >= op_count || instructions[lane].op != op_vadd ||
+                    instructions[lane].val < 32) {
+                emit_vzeroupper(buffer);
+            }
+            break;
+        case 64:
+            emit_vmovdqu64_z_rmdisp(buffer, XMM0, reg, offset);
+            emit_vpaddb_z_z_label(buffer, XMM0, XMM0, constant->label);
+            emit_vmovdqu64_rmdisp_z(buffer, reg, offset, XMM0);
+
+            if (lane >= op_count || instructions[lane].op != op_vadd ||
+                    instructions[lane].val < 32) {
+                emit_vzeroupper(buffer);
+            }
+            break;
+        default:
+            assert(0);
+            break;
+    }
+}
+
+/**
+ * Emits the op_vstore at op, storing the op_lanes that follow it to its
+ * window of cells at once, as emit_vadd adds them.  The add to zero is
+ * omitted if every lane is cleared.  Returns nonzero if constant was used,
+ * and so must be emitted after the code.
+ *
+ * pxor %xmm0, %xmm0
+ * paddb constant(%rip), %xmm0
+ * movdqu %xmm0, offset(%ptrreg)
+ */
+static int emit_vstore(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t op, vector_constant_t * constant) {
+    const instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+
+    size_t lane;
+    int nonzero = 0;
+    for (lane = op + 1; lane < op_count &&
+            instructions[lane].op == op_lane; lane++) {
+        const ptrdiff_t at =
+            instructions[lane].offset - instructions[op].offset;
+        assert(at >= 0 && at < instructions[op].val);
+        constant->bytes[at] = (uint8_t) instructions[lane].val;
+        nonzero |= constant->bytes[at] != 0;
+    }
+
+    const ptrdiff_t width = instructions[op].val;
+    if (width >= 32) {
+        emit_vpxor_y_y_y(buffer, XMM0, XMM0, XMM0);
+    } else {
+        emit_pxor_x_x(buffer, XMM0, XMM0);
+    }
+
+    if (nonzero) {
+        constant->label = new_label(buffer);
+
+        if (width == 64) {
+            emit_vpaddb_z_z_label(buffer, XMM0, XMM0, constant->label);
+        } else if (width == 32) {
+            emit_vpaddb_y_y_label(buffer, XMM0, XMM0, constant->label);
+        } else {
+            emit_paddb_x_label(buffer, XMM0, constant->label);
+        }
+    }
+
+    const int32_t offset = (int32_t) instructions[op].offset;
+    switch (width) {
+        case 4:
+            emit_movd_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 8:
+            emit_movq_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 16:
+            emit_movdqu_rmdisp_x(buffer, reg, offset, XMM0);
+            break;
+        case 32:
+        case 64:
+            if (width == 64) {
+                emit_vmovdqu64_rmdisp_z(buffer, reg, offset, XMM0);
+            } else {
+                emit_vmovdqu_rmdisp_y(buffer, reg, offset, XMM0);
+            }
+
+            if (lane >= op_count || instructions[lane].op != op_vstore ||
+                    instructions[lane].val < 32) {
+                emit_vzeroupper(buffer);
+            }
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+    return nonzero;
+}
+#endif
+
+/**
+ * Emits a sweep, clearing cells and moving the pointer right until it reaches
+ * a zero cell.  On x86_64, once the pointer is aligned, whole blocks (of the
+ * size emit_scan would use) are tested for zeros and cleared at a time.
+ * Blocks are aligned, so they never cross into a guard page unless the
+ * cell-wise loop would have touched it too.
+ */
+static void emit_sweep(assembler_buffer_t buffer, asm_register_t reg,
+        unsigned features, unsigned cell_size) {
+    label_t top = new_label(buffer);
+    label_t end = new_label(buffer);
+
+    /*
+     * top:
+     * cmp r/m 0
+     * je end
+     * mov 0, (%ptrreg)
+     * addl cell_size, %ptrreg
+     */
+    emit_push_label(buffer, top);
+    emit_cell_cmp_zero(buffer, cell_size, reg, 0);
+    emit_je(buffer, end);
+    emit_cell_store_imm(buffer, cell_size, reg, 0, 0);
+    emit_add_r_immz32(buffer, reg, cell_size);
+
+    #if defined(HOST_ARCH_X64)
+    const uint32_t block =
+        (features & cpu_avx512bw) && cell_size == 1 ? 64u :
+        (features & cpu_avx2)                       ? 32u : 16u;
+
+    label_t loop = new_label(buffer);
+    label_t tail = new_label(buffer);
+
+    /*
+     * movq %ptrreg, %rcx
+     * andq block - 1, %rcx
+     * jne top
+     * pxor %xmm0, %xmm0
+     */
+    emit_mov_r_r(buffer, ECX, reg);
+    emit_and_r_immz32(buffer, ECX, block - 1u);
+    emit_jne(buffer, top);
+    if (block >= 32u) {
+        emit_vpxor_y_y_y(buffer, XMM0, XMM0, XMM0);
+    } else {
+        emit_pxor_x_x(buffer, XMM0, XMM0);
+    }
+
+    /*
+     * loop:
+     * movdqa (%ptrreg), %xmm1
+     * pcmpeqb %xmm0, %xmm1 (pcmpeqw, pcmpeqd)
+     * pmovmskb %xmm1, %ecx
+     * andl %ecx, %ecx
+     * jne tail
+     * movdqu %xmm0, (%ptrreg)
+     * addq block, %ptrreg
+     * jmp loop
+     *
+     * AVX-512BW tests the compare in %k1 with kortestq instead.
+     */
+    emit_push_label(buffer, loop);
+    if (block == 64u) {
+        emit_vmovdqa64_z_rm(buffer, XMM1, reg);
+        emit_vpcmpeqb_k_z_z(buffer, K1, XMM1, XMM0);
+        emit_kortestq_k_k(buffer, K1, K1);
+    } else if (block == 32u) {
+        emit_vmovdqa_y_rm(buffer, XMM1, reg);
+        emit_vpcmpeq_cells(buffer, cell_size);
+        emit_vpmovmskb_r_y(buffer, ECX, XMM1);
+        emit_and_r_r(buffer, ECX, ECX);
+    } else {
+        emit_movdqa_x_rm(buffer, XMM1, reg);
+        emit_pcmpeq_cells(buffer, cell_size);
+        emit_pmovmskb_r_x(buffer, ECX, XMM1);
+        emit_and_r_r(buffer, ECX, ECX);
+    }
+    emit_jne(buffer, tail);
+    if (block == 64u) {
+        emit_vmovdqu64_rmdisp_z(buffer, reg, 0, XMM0);
+    } else if (block == 32u) {
+        emit_vmovdqu_rmdisp_y(buffer, reg, 0, XMM0);
+    } else {
+        emit_movdqu_rmdisp_x(buffer, reg, 0, XMM0);
+    }
+    emit_add_r_immz32(buffer, reg, block);
+    emit_jmp(buffer, loop);
+
+    /*
+     * tail:
+     * jmp top
+     *
+     * The zero lies within this block, so the cell loop finishes before it
+     * returns here.
+     */
+    emit_push_label(buffer, tail);
+    if (block >= 32u) {
+        emit_vzeroupper(buffer);
+    }
+    #endif
+
+    emit_jmp(buffer, top);
+    emit_push_label(buffer, end);
+}
+
+/**
+ * Emits an op_select and its body without branching.  The cell is tested
+ * once, leaving a mask in EDX of all ones if it is nonzero and zero if not.
+ * Each instruction of the body is then applied through that mask:  a skipped
+ * instruction addresses the current cell, which is zero, and stores or adds
+ * zero to it.  No cell is touched that the loop itself would not have
+ * touched.
+ */
+static void emit_select(assembler_buffer_t buffer, asm_register_t reg,
+        const instruction_t * select, unsigned cell_size) {
+    /*
+     * xorl %edx, %edx
+     * cmp r/m 0
+     * setne %dl
+     * negq %rdx
+     */
+    emit_xor_r_r(buffer, EDX, EDX);
+    emit_cell_cmp_zero(buffer, cell_size, reg, 0);
+    emit_setne_r8(buffer, EDX);
+    emit_neg_r(buffer, EDX);
+
+    const uint32_t mask = cell_mask(cell_size);
+    ptrdiff_t i;
+    for (i = 1; i <= select->val; i++) {
+        const instruction_t * inst = &select[i];
+        const uint32_t value = (uint32_t) inst->val & mask;
+        if (inst->op == op_modify && value == 0) {
+            continue;
+        }
+
+        asm_register_t base = reg;
+        if (inst->offset != 0) {
+            /*
+             * movl offset * cell_size, %edi
+             * andq %rdx, %rdi
+             * addq %ptrreg, %rdi
+             */
+            emit_mov_r_imm32(buffer, EDI,
+                (uint32_t) inst->offset * cell_size);
+            emit_and_r_r(buffer, EDI, EDX);
+            emit_add_r_r(buffer, EDI, reg);
+            base = EDI;
+        }
+
+        switch (inst->op) {
+            case op_clear:
+            case op_set:
+                if (value == 0) {
+                    /* mov 0, (base) */
+                    emit_cell_store_imm(buffer, cell_size, base, 0, 0);
+                    break;
+                }
+
+                /*
+                 * movl value, %eax
+                 * andq %rdx, %rax
+                 * mov %al, (base) (%ax, %eax)
+                 */
+                emit_mov_r_imm32(buffer, EAX, value);
+                emit_and_r_r(buffer, EAX, EDX);
+                emit_cell_store_r(buffer, cell_size, base, 0, EAX);
+                break;
+            case op_modify:
+                /*
+                 * movl value, %eax
+                 * andq %rdx, %rax
+                 * add %al, (base) (%ax, %eax)
+                 */
+                emit_mov_r_imm32(buffer, EAX, value);
+                emit_and_r_r(buffer, EAX, EDX);
+                emit_cell_add_r(buffer, cell_size, base, 0, EAX);
+                break;
+            case op_mul:
+                /*
+                 * mov (%ptrreg), %al (movzwl, movl to %eax)
+                 * imull factor, %eax, %ecx
+                 * add %cl, (base) (%cx, %ecx)
+                 *
+                 * The product is already zero if the cell is.
+                 */
+                emit_cell_load_r(buffer, cell_size, EAX, reg, 0);
+                if (value == 1) {
+                    emit_cell_add_r(buffer, cell_size, base, 0, EAX);
+                } else if (value == mask) {
+                    emit_cell_sub_r(buffer, cell_size, base, 0, EAX);
+                } else {
+                    emit_cell_imul(buffer, cell_size, ECX, EAX, value);
+                    emit_cell_add_r(buffer, cell_size, base, 0, ECX);
+                }
+                break;
+            default:
+                assert(0);
+                break;
+        }
+    }
+}
+
+/**
+ * Emits an op_divmod, which checks that the cells are laid out as the divmod
+ * loop expects and, if so, does its work with a single division.  Otherwise
+ * the loop that follows runs as usual.  Cells past the current one are only
+ * read if the loop would read them, so no new faults are possible.
+ *
+ * With a count down c1 and count up c2 summing to the divisor, the loop's n
+ * steps leave the count up at (c2 + n) % divisor, and add (c2 + n) / divisor
+ * to the quotient.
+ */
+static void emit_divmod(assembler_buffer_t buffer, asm_register_t reg) {
+    label_t end = new_label(buffer);
+
+    /*
+     * cmp r/m8 0
+     * je end
+     * cmpb 0, 4(%ptrreg)
+     * jne end
+     * cmpb 0, 5(%ptrreg)
+     * jne end
+     * cmpb 0, 1(%ptrreg)
+     * je end
+     */
+    emit_cmp_rm8_imm8(buffer, reg, 0);
+    emit_je(buffer, end);
+    emit_cmp_rm8disp_imm8(buffer, reg, 4, 0);
+    emit_jne(buffer, end);
+    emit_cmp_rm8disp_imm8(buffer, reg, 5, 0);
+    emit_jne(buffer, end);
+    emit_cmp_rm8disp_imm8(buffer, reg, 1, 0);
+    emit_je(buffer, end);
+
+    /*
+     * movzbl 1(%ptrreg), %ecx
+     * movzbl 2(%ptrreg), %eax
+     * addl %eax, %ecx
+     * cmpl 1, %ecx
+     * jle end
+     * cmpl 255, %ecx
+     * jg end
+     */
+    emit_movzx_r_rm8disp(buffer, ECX, reg, 1);
+    emit_movzx_r_rm8disp(buffer, EAX, reg, 2);
+    emit_add_r_r(buffer, ECX, EAX);
+    emit_cmp_r_immz32(buffer, ECX, 1u);
+    emit_jle(buffer, end);
+    emit_cmp_r_immz32(buffer, ECX, 255u);
+    emit_jg(buffer, end);
+
+    /*
+     * movzbl (%ptrreg), %edx
+     * addl %edx, %eax
+     * xorl %edx, %edx
+     * divl %ecx
+     * addb %al, 3(%ptrreg)
+     * movb %dl, 2(%ptrreg)
+     * negl %edx
+     * addl %ecx, %edx
+     * movb %dl, 1(%ptrreg)
+     * movb 0, (%ptrreg)
+     * end:
+     */
+    emit_movzx_r_rm8disp(buffer, EDX, reg, 0);
+    emit_add_r_r(buffer, EAX, EDX);
+    emit_xor_r_r(buffer, EDX, EDX);
+    emit_div_r(buffer, ECX);
+    emit_add_rm8disp_r8(buffer, reg, 3, EAX);
+    emit_mov_rm8disp_r8(buffer, reg, 2, EDX);
+    emit_neg_r(buffer, EDX);
+    emit_add_r_r(buffer, EDX, ECX);
+    emit_mov_rm8disp_r8(buffer, reg, 1, EDX);
+    emit_mov_rm8disp_imm8(buffer, reg, 0, 0);
+    emit_push_label(buffer, end);
+}
+
+/**
+ * Returns nonzero if loop may be outlined.  Only loops still emitted, from
+ * first on, are outlined, and never one the generated code resumes into.  A
+ * stub runs with its return address on the stack, so loops that call out for
+ * I/O, which expects the stack aligned, or whose guards branch to a fallback
+ * outside them are left inline:  leaves, from match_loops, notes these.
+ */
+static int is_outlinable(const program_t * program, const int * leaves,
+        size_t loop, size_t first, size_t resume, size_t min_size) {
+    const loop_t * l = &program->loops[loop];
+    return program->instructions[l->open].op == op_if && l->open >= first &&
+        !(l->open < resume && resume <= l->close) &&
+        l->close - l->open + 1u >= min_size && !(leaves[loop]);
+}
+
+/**
+ * Chooses the loops to outline.  A loop of at least min_size instructions
+ * that appears more than once is emitted only where it first appears, as a
+ * stub that every copy calls with the pointer in its usual register.
+ * outlined[i] is set to the loop whose stub loop i calls, or SIZE_MAX if loop
+ * i is emitted inline.  A min_size of zero disables outlining.
+ */
+static int outline_loops(const program_t * program, size_t first,
+        size_t resume, size_t min_size, arena_t * arena, size_t * outlined) {
+    const size_t loop_count = program->loop_count;
+
+    size_t i;
+    if (min_size == 0) {
+        for (i = 0; i < loop_count; i++) {
+            outlined[i] = SIZE_MAX;
+        }
+
+        return interpret_ok;
+    }
+
+    size_t * leaders =
+        arena_alloc(arena, sizeof(size_t) * 2u * (loop_count + 1u));
+    if (!(leaders)) {
+        return interpret_malloc_error;
+    }
+    size_t * copies = leaders + loop_count + 1u;
+    int * leaves = arena_alloc(arena, sizeof(int) * (loop_count + 1u));
+    if (!(leaves)) {
+        return interpret_malloc_error;
+    }
+
+    int ret = match_loops(program, outlined, leaves, &analysis_steps);
+    if (ret != interpret_ok) {
+        return ret;
+    }
+
+    for (i = 0; i < loop_count; i++) {
+        leaders[i]  = SIZE_MAX;
+        copies[i]   = 0;
+    }
+
+    for (i = 0; i < loop_count; i++) {
+        if (!(is_outlinable(program, leaves, i, first, resume, min_size))) {
+            outlined[i] = SIZE_MAX;
+            continue;
+        }
+
+        const size_t twin = outlined[i];
+        if (leaders[twin] == SIZE_MAX) {
+            leaders[twin] = i;
+        }
+        copies[twin]++;
+    }
+
+    for (i = 0; i < loop_count; i++) {
+        if (outlined[i] != SIZE_MAX) {
+            outlined[i] = copies[outlined[i]] > 1u ?
+                leaders[outlined[i]] : SIZE_MAX;
+        }
+    }
+
+    return interpret_ok;
+}
+
+#define MAX_CACHED_CELLS 8
+#define MAX_LOOP_CELLS 32
+
+#if defined(HOST_ARCH_X64)
+/**
+ * The registers that may hold cells, in the order they are handed out.  The
+ * loops that use them make no calls, so r8 through r11 need not be saved;
+ * the prologue saves r12 through r15 for our caller.
+ */
+static const asm_register_t cell_registers[MAX_CACHED_CELLS] = {
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+#endif
+
+/**
+ * The cells kept in registers while a loop runs:  the cell at offset[i] from
+ * the pointer is held in cell_registers[i].
+ */
+typedef struct cell_cache {
+    size_t    count;
+    ptrdiff_t offset[MAX_CACHED_CELLS];
+} cell_cache_t;
+
+/**
+ * An op_cold region, emitted after the coda rather than where it opens, along
+ * with the cache in effect there.
+ */
+typedef struct cold_region {
+    size_t               open;
+    const cell_cache_t * cache;
+} cold_region_t;
+
+/**
+ * Works out which loops have bodies that may run with their cells in
+ * registers, in one pass over the program:  fits[i] is set nonzero if loop i
+ * is an op_if loop whose body, nested loops included, only modifies, clears,
+ * sets and multiplies cells, and none of whose nested loops is outlined.  A
+ * loop fits only if its own instructions and each loop nested in it do.
+ * stack has room for max_depth loops.
+ */
+static void fit_loops(const program_t * program, const size_t * outlined,
+        size_t * stack, int * fits) {
+    const instruction_t * instructions = program->instructions;
+
+    size_t depth = 0, op;
+    for (op = 0; op < program->count; op++) {
+        const instruction_t * inst = &instructions[op];
+        analysis_steps++;
+        switch (inst->op) {
+            case op_if:
+            case op_fallback:
+            case op_cold:
+                assert(depth < program->max_depth);
+                fits[inst->branch] = inst->op == op_if;
+                stack[depth++] = inst->branch;
+                continue;
+            case op_endif:
+            case op_join:
+                assert(depth > 0);
+                depth--;
+                if (depth > 0 && (!(fits[inst->branch]) ||
+                        outlined[inst->branch] != SIZE_MAX)) {
+                    fits[stack[depth - 1u]] = 0;
+                }
+                continue;
+            case op_mul:
+            case op_modify:
+            case op_clear:
+            case op_set:
+                continue;
+            default:
+                if (depth > 0) {
+                    fits[stack[depth - 1u]] = 0;
+                }
+                continue;
+        }
+    }
+}
+
+/**
+ * Chooses the cells to keep in registers while loop runs, leaving
+ * cache->count zero if it runs from memory.  Only a loop over byte cells that
+ * fits, from fit_loops, that iterates and that is not resumed into is
+ * cached.  It neither moves the pointer nor calls out, so each of its cells
+ * stays at one offset from the pointer and in one register throughout.
+ *
+ * The control cell comes first, then the cells accessed most often.  Cells
+ * are loaded on entry, so only those the first iteration is sure to access,
+ * ahead of any nested loop, are cached:  loading any other might fault where
+ * the loop would not.  Only the first MAX_LOOP_CELLS of these are counted.
+ */
+static void cache_loop(const program_t * program, size_t loop, size_t resume,
+        const int * fits, cell_cache_t * cache) {
+    cache->count = 0;
+
+    #if defined(HOST_ARCH_X64)
+    const instruction_t * instructions = program->instructions;
+    const loop_t * l = &program->loops[loop];
+    if (program->cell_size != 1 || !(fits[loop]) ||
+            instructions[l->close].val != 0 ||
+            (l->open < resume && resume <= l->close)) {
+        return;
+    }
+
+    ptrdiff_t offsets[MAX_LOOP_CELLS];
+    size_t    uses[MAX_LOOP_CELLS];
+    size_t    cells = 1, i, op;
+    int       nested = 0;
+
+    /* The control cell, tested on entry and at the back edge. */
+    offsets[0]  = 0;
+    uses[0]     = 2;
+
+    for (op = l->open + 1; op < l->close; op++) {
+        const instruction_t * inst = &instructions[op];
+        analysis_steps++;
+        switch (inst->op) {
+            case op_if:
+                nested = 1;
+                uses[0]++;
+                continue;
+            case op_endif:
+                uses[0]++;
+                continue;
+            case op_mul:
+                uses[0]++;
+                break;
+            default:
+                break;
+        }
+
+        for (i = 0; i < cells && offsets[i] != inst->offset; i++) {
+            /* Find the cell. */
+        }
+
+        if (i == cells) {
+            if (nested || cells == MAX_LOOP_CELLS) {
+                continue;
+            }
+
+            offsets[i]  = inst->offset;
+            uses[i]     = 0;
+            cells++;
+        }
+        uses[i]++;
+    }
+
+    cache->offset[0] = 0;
+    cache->count = 1;
+    while (cache->count < MAX_CACHED_CELLS) {
+        size_t best = 0;
+        for (i = 1; i < cells; i++) {
+            if (uses[i] > 0 && (best == 0 || uses[i] > uses[best])) {
+                best = i;
+            }
+        }
+
+        if (best == 0) {
+            break;
+        }
+
+        cache->offset[cache->count++] = offsets[best];
+        uses[best] = 0;
+    }
+    #else
+    (void) program;
+    (void) loop;
+    (void) resume;
+    (void) fits;
+    #endif
+}
+
+/**
+ * Returns nonzero if the cell at offset is held in a register, storing it to
+ * reg.  A NULL cache holds nothing.
+ */
+static int is_cached(const cell_cache_t * cache, ptrdiff_t offset,
+        asm_register_t * reg) {
+    #if defined(HOST_ARCH_X64)
+    size_t i;
+    for (i = 0; cache && i < cache->count; i++) {
+        if (cache->offset[i] == offset) {
+            *reg = cell_registers[i];
+            return 1;
+        }
+    }
+    #else
+    (void) cache;
+    (void) offset;
+    (void) reg;
+    #endif
+
+    return 0;
+}
+
+/**
+ * Loads the cached cells into their registers, or stores them back if store
+ * is nonzero.
+ *
+ * movb offset(%ptrreg), %r8b / movb %r8b, offset(%ptrreg)
+ */
+static void emit_cache(assembler_buffer_t buffer, asm_register_t reg,
+        const cell_cache_t * cache, int store) {
+    #if defined(HOST_ARCH_X64)
+    size_t i;
+    for (i = 0; i < cache->count; i++) {
+        const int32_t offset = (int32_t) cache->offset[i];
+        if (store) {
+            emit_mov_rm8disp_r8(buffer, reg, offset, cell_registers[i]);
+        } else {
+            emit_mov_r8_rm8disp(buffer, cell_registers[i], reg, offset);
+        }
+    }
+    #else
+    (void) buffer;
+    (void) reg;
+    (void) cache;
+    (void) store;
+    #endif
+}
+
+/**
+ * Emits the op_mul at op, adding the control cell times its factor to its
+ * cell.  Consecutive multiplications share the load of the control cell.
+ * Factors of 1 and -1 need no multiply.  Either cell may be cached in a
+ * register instead.
+ *
+ * movb (%ptrreg), %al (movzwl, movl to %eax)
+ * imull factor, %eax, %ecx
+ * addb %cl, offset(%ptrreg) (%cx, %ecx)
+ */
+static void emit_mul(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t op, const cell_cache_t * cache) {
+    const instruction_t * instructions = program->instructions;
+    const unsigned cell_size = program->cell_size;
+    const uint32_t mask = cell_mask(cell_size);
+    asm_register_t cell;
+
+    assert(op > 0);
+    if (instructions[op - 1].op != op_mul) {
+        if (is_cached(cache, 0, &cell)) {
+            emit_mov_r8_r8(buffer, EAX, cell);
+        } else {
+            emit_cell_load_r(buffer, cell_size, EAX, reg, 0);
+        }
+    }
+
+    const uint32_t factor = (uint32_t) instructions[op].val & mask;
+    const ptrdiff_t offset = instructions[op].offset;
+    asm_register_t product = EAX;
+    if (factor != 1 && factor != mask) {
+        emit_cell_imul(buffer, cell_size, ECX, EAX, factor);
+        product = ECX;
+    }
+
+    if (is_cached(cache, offset, &cell)) {
+        if (factor == mask) {
+            emit_sub_r8_r8(buffer, cell, product);
+        } else {
+            emit_add_r8_r8(buffer, cell, product);
+        }
+    } else if (factor == mask) {
+        emit_cell_sub_r(buffer, cell_size, reg,
+            cell_disp(offset, cell_size), product);
+    } else {
+        emit_cell_add_r(buffer, cell_size, reg,
+            cell_disp(offset, cell_size), product);
+    }
+}
+
+/**
+ * Emits the op_if opening loop.  An outlined loop is called at each of its
+ * copies, and only the first is emitted, as the stub, behind a jump; returns
+ * nonzero at the others, whose bodies are then skipped.  A cached loop, if
+ * not nested in another, loads its cells into registers and sets *cache.
+ * flags_set is nonzero if the flags already test the current cell.
+ */
+static int emit_if(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t loop, const branch_t * branches,
+        const size_t * outlined, const cell_cache_t * caches,
+        const cell_cache_t ** cache, int flags_set) {
+    const instruction_t * inst = &program->instructions[
+        program->loops[loop].open];
+    const size_t stub = outlined[loop];
+    asm_register_t cell;
+
+    if (stub != SIZE_MAX) {
+        /*
+         * call stub
+         *
+         * Only the first copy of the loop is emitted, behind a jump, and the
+         * rest are skipped:
+         *
+         * jmp after
+         * stub:
+         */
+        emit_call_label(buffer, branches[stub].stub);
+        if (stub != loop) {
+            return 1;
+        }
+
+        emit_jmp(buffer, branches[loop].after);
+        emit_push_label(buffer, branches[loop].stub);
+    }
+
+    /*
+     * cmp r/m 0
+     * je end
+     * top:
+     *
+     * The test is omitted if the loop is known to be entered.  A cached loop
+     * loads its cells ahead of top.
+     */
+    if (inst->val == 0) {
+        if (is_cached(*cache, 0, &cell)) {
+            if (!(flags_set)) {
+                emit_cmp_r8_imm8(buffer, cell, 0);
+            }
+        } else if (!(flags_set) || stub != SIZE_MAX) {
+            emit_cell_cmp_zero(buffer, program->cell_size, reg, 0);
+        }
+
+        assert(branches[loop].end);
+        emit_je(buffer, branches[loop].end);
+    }
+    if (!(*cache) && caches[loop].count > 0) {
+        *cache = &caches[loop];
+        emit_cache(buffer, reg, *cache, 0);
+    }
+
+    if (is_innermost(program, loop)) {
+        emit_align(buffer, 16);
+    }
+    emit_push_label(buffer, branches[loop].top);
+
+    return 0;
+}
+
+/**
+ * Emits the op_endif closing loop.  A cached loop stores its cells back as it
+ * falls through to end, clearing *cache, and an outlined loop's stub returns.
+ * flags_set is as for emit_if.
+ */
+static void emit_endif(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t loop, const branch_t * branches,
+        const size_t * outlined, const cell_cache_t * caches,
+        const cell_cache_t ** cache, int flags_set) {
+    const instruction_t * inst = &program->instructions[
+        program->loops[loop].close];
+    asm_register_t cell;
+
+    /*
+     * cmp r/m 0
+     * jne top
+     * end:
+     *
+     * The test is omitted if the loop is known to exit.
+     */
+    if (inst->val == 0) {
+        if (flags_set) {
+            /* The flags are already set. */
+        } else if (is_cached(*cache, 0, &cell)) {
+            emit_cmp_r8_imm8(buffer, cell, 0);
+        } else {
+            emit_cell_cmp_zero(buffer, program->cell_size, reg, 0);
+        }
+        emit_jne(buffer, branches[loop].top);
+    }
+    if (*cache == &caches[loop]) {
+        emit_cache(buffer, reg, *cache, 1);
+        *cache = NULL;
+    }
+    emit_push_label(buffer, branches[loop].end);
+
+    /*
+     * ret
+     * after:
+     *
+     * This ends the stub of an outlined loop.
+     */
+    if (outlined[loop] == loop) {
+        emit_ret(buffer);
+        emit_push_label(buffer, branches[loop].after);
+    }
+}
+
+/**
+ * Emits the op_fallback opening loop, the guarded loop's slow copy.  The fast
+ * copy ahead of it jumps over it, and its guards enter it at head.
+ *
+ * jmp end
+ * head:
+ * cmp r/m 0
+ * je end
+ * top:
+ */
+static void emit_fallback(assembler_buffer_t buffer, asm_register_t reg,
+        const program_t * program, size_t loop, branch_t * branches) {
+    branch_t * branch = &branches[loop];
+    if (!(branch->head)) {
+        /* Its guard was never emitted. */
+        branch->head = new_label(buffer);
+    }
+
+    emit_jmp(buffer, branch->end);
+    emit_push_label(buffer, branch->head);
+    emit_cell_cmp_zero(buffer, program->cell_size, reg, 0);
+    emit_je(buffer, branch->end);
+    if (is_innermost(program, loop)) {
+        emit_align(buffer, 16);
+    }
+    emit_push_label(buffer, branch->top);
+}
+
+/**
+ * Emits the op_cold opening the cold region loop, once it is emitted after
+ * the coda.  Its guards enter it at head.
+ *
+ * head:
+ */
+static void emit_cold(assembler_buffer_t buffer, size_t loop,
+        branch_t * branches) {
+    branch_t * branch = &branches[loop];
+    if (!(branch->head)) {
+        /* Its guard was never emitted. */
+        branch->head = new_label(buffer);
+    }
+    emit_push_label(buffer, branch->head);
+}
+
+/**
+ * Emits the op_join of the cold region loop.  Where the region was deferred,
+ * the code it returns to follows; closing the region itself, it jumps back
+ * there.
+ *
+ * end: (where the region was deferred)
+ * jmp end (closing the region itself)
+ */
+static void emit_join(assembler_buffer_t buffer, size_t loop,
+        const branch_t * branches, int closing) {
+    if (closing) {
+        emit_jmp(buffer, branches[loop].end);
+    } else {
+        emit_push_label(buffer, branches[loop].end);
+    }
+}
+
+typedef struct output {
+    char * buffer;
+    size_t size;
+    size_t capacity;
+} output_t;
+
+static int append_output(output_t * output, uint8_t ch) {
+    if (output->size == output->capacity) {
+        size_t capacity = output->capacity ? 2u * output->capacity : 256u;
+        char * buffer = realloc(output->buffer, capacity);
+        if (!(buffer)) {
+            return interpret_malloc_error;
+        }
+
+        output->buffer      = buffer;
+        output->capacity    = capacity;
+    }
+
+    output->buffer[output->size++] = (char) ch;
+    return interpret_ok;
+}
+
+/**
+ * Reads and writes the cell at index at of a tape of cells cell_size bytes
+ * wide.  Values written are truncated to the cell.
+ */
+static uint32_t get_cell(const char * tape_start, unsigned cell_size,
+        ptrdiff_t at) {
+    const char * cell = tape_start + at * (ptrdiff_t) cell_size;
+    switch (cell_size) {
+        case 1:
+            return (uint8_t) *cell;
+        case 2:
+            {
+            uint16_t value;
+            memcpy(&value, cell, sizeof(value));
+            return value;
+            }
+        default:
+            {
+            uint32_t value;
+            memcpy(&value, cell, sizeof(value));
+            return value;
+            }
+    }
+}
+
+static void set_cell(char * tape_start, unsigned cell_size, ptrdiff_t at,
+        uint32_t value) {
+    char * cell = tape_start + at * (ptrdiff_t) cell_size;
+    switch (cell_size) {
+        case 1:
+            *cell = (char) (uint8_t) value;
+            break;
+        case 2:
+            {
+            const uint16_t truncated = (uint16_t) value;
+            memcpy(cell, &truncated, sizeof(truncated));
+            }
+            break;
+        default:
+            memcpy(cell, &value, sizeof(value));
+            break;
+    }
+}
+
+/**
+ * Checks that a cell lies within the tape, returning the error the generated
+ * code would raise on touching it otherwise.
+ */
+static int check_cell(ptrdiff_t at, size_t tape_size) {
+    if (at < 0) {
+        return interpret_tape_underflow;
+    } else if ((size_t) at >= tape_size) {
+        return interpret_tape_exceeded;
+    }
+
+    return interpret_ok;
+}
+
+/**
+ * Runs the program at compile time until it first reads input, finishes, or
+ * has executed about steps instructions, writing directly to the tape.
+ *
+ * Evaluation only stops where the generated code can pick up:  at a loop
+ * test, a scan or an input.  *resume and *position are set to the instruction
+ * and the pointer to continue from, and any output is accumulated in output.
+ * Cells beyond the tape, which holds tape_size cells, are reported as the
+ * generated code would report them.
+ */
+static int evaluate(const program_t * program, char * tape_start,
+        size_t tape_size, size_t steps, size_t * resume, ptrdiff_t * position,
+        output_t * output) {
+    const instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+    const loop_t * loops = program->loops;
+    const unsigned cell_size = program->cell_size;
+    ptrdiff_t p = 0;
+    size_t    i = 0;
+    int     ret = interpret_ok;
+    op_t  lanes = op_vadd;
+
+    while (i < op_count && ret == interpret_ok) {
+        const instruction_t * inst = &instructions[i];
+        if (inst->op == op_get) {
+            break;
+        } else if (steps == 0 && (inst->op == op_if ||
+                inst->op == op_endif || inst->op == op_scan ||
+                inst->op == op_sweep)) {
+            break;
+        }
+
+        if (steps > 0) {
+            steps--;
+        }
+
+        const ptrdiff_t at = p + inst->offset;
+        switch (inst->op) {
+            case op_right:
+                p += inst->val;
+                break;
+            case op_left:
+                p = p > inst->val ? p - inst->val : 0;
+                break;
+            case op_modify:
+                if ((ret = check_cell(at, tape_size)) == interpret_ok) {
+                    set_cell(tape_start, cell_size, at,
+                        get_cell(tape_start, cell_size, at) +
+                        (uint32_t) inst->val);
+                }
+                break;
+            case op_vadd:
+            case op_vstore:
+                lanes = inst->op;
+                break;
+            case op_lane:
+                if ((ret = check_cell(at, tape_size)) == interpret_ok) {
+                    set_cell(tape_start, cell_size, at, (lanes == op_vadd ?
+                        get_cell(tape_start, cell_size, at) : 0u) +
+                        (uint32_t) inst->val);
+                }
+                break;
+            case op_clear:
+            case op_set:
+                if ((ret = check_cell(at, tape_size)) == interpret_ok) {
+                    set_cell(tape_start, cell_size, at, (uint32_t) inst->val);
+                }
+                break;
+            case op_put:
+                if ((ret = check_cell(at, tape_size)) == interpret_ok) {
+                    ret = append_output(output,
+                        (uint8_t) get_cell(tape_start, cell_size, at));
+                }
+                break;
+            case op_print:
+                ret = append_output(output, (uint8_t) inst->val);
+                break;
+            case op_mul:
+                if ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                        (ret = check_cell(at, tape_size)) == interpret_ok) {
+                    set_cell(tape_start, cell_size, at,
+                        get_cell(tape_start, cell_size, at) +
+                        get_cell(tape_start, cell_size, p) *
+                        (uint32_t) inst->val);
+                }
+                break;
+            case op_scan:
+                {
+                /* Scans may be long, so charge each step.  If we run out,
+                 * leave the scan to the generated code. */
+                ptrdiff_t q = p;
+                size_t    n = 0;
+                while ((ret = check_cell(q, tape_size)) == interpret_ok &&
+                        get_cell(tape_start, cell_size, q) != 0 &&
+                        n <= steps) {
+                    q = q + inst->val > 0 ? q + inst->val : 0;
+                    n++;
+                }
+
+                if (ret == interpret_ok && n > steps) {
+                    *resume     = i;
+                    *position   = p;
+                    return interpret_ok;
+                }
+
+                steps -= n;
+                p = q;
+                }
+                break;
+            case op_sweep:
+                {
+                /* As for scans, but the cells already cleared stay cleared,
+                 * so the generated code picks up from where we stopped. */
+                size_t n = 0;
+                while ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                        get_cell(tape_start, cell_size, p) != 0 &&
+                        n <= steps) {
+                    set_cell(tape_start, cell_size, p, 0);
+                    p++;
+                    n++;
+                }
+
+                if (ret == interpret_ok && n > steps) {
+                    *resume     = i;
+                    *position   = p;
+                    return interpret_ok;
+                }
+
+                steps -= n;
+                }
+                break;
+            case op_guard:
+                if (p < inst->val) {
+                    const loop_t * target = &loops[inst->branch];
+                    i = target->open + 1;
+                    if (instructions[target->open].op == op_fallback) {
+                        if ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                                get_cell(tape_start, cell_size, p) == 0) {
+                            i = target->close + 1;
+                        }
+                    }
+                    continue;
+                }
+                break;
+            case op_if:
+                if (inst->val == 0) {
+                    if ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                            get_cell(tape_start, cell_size, p) == 0) {
+                        i = loops[inst->branch].close + 1;
+                        continue;
+                    }
+                }
+                break;
+            case op_endif:
+                if (inst->val == 0) {
+                    if ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                            get_cell(tape_start, cell_size, p) != 0) {
+                        i = loops[inst->branch].open + 1;
+                        continue;
+                    }
+                }
+                break;
+            case op_divmod:
+                {
+                /* Anything out of the ordinary is left to the loop, as is
+                 * reporting a loop that runs off the end of the tape.  Only
+                 * byte cells have op_divmod. */
+                uint8_t * cells = (uint8_t *) tape_start;
+                assert(cell_size == 1);
+                if (check_cell(p, tape_size) == interpret_ok && cells[p] != 0 &&
+                        check_cell(p + 5, tape_size) == interpret_ok &&
+                        cells[p + 4] == 0 && cells[p + 5] == 0 &&
+                        cells[p + 1] != 0) {
+                    const unsigned divisor = cells[p + 1] + cells[p + 2];
+                    const unsigned count   = cells[p + 2] + cells[p];
+                    if (divisor >= 2 && divisor <= 255) {
+                        cells[p + 3] =
+                            (uint8_t) (cells[p + 3] + count / divisor);
+                        cells[p + 2] = (uint8_t) (count % divisor);
+                        cells[p + 1] = (uint8_t) (divisor - count % divisor);
+                        cells[p]     = 0;
+                    }
+                }
+                }
+                break;
+            case op_select:
+                if ((ret = check_cell(p, tape_size)) == interpret_ok &&
+                        get_cell(tape_start, cell_size, p) == 0) {
+                    i += (size_t) inst->val + 1u;
+                    continue;
+                }
+                break;
+            case op_fallback:
+            case op_cold:
+                /* Only reachable from a guard. */
+                i = loops[inst->branch].close + 1;
+                continue;
+            case op_join:
+                break;
+            default:
+                assert(0);
+                break;
+        }
+
+        i++;
+    }
+
+    *resume     = i;
+    *position   = p;
+    return ret;
 }
 
-typedef struct link {
-    size_t   offset;
-    struct link * previous;
-} link_t;
+void interpret_default_options(interpret_options_t * options) {
+    assert(options);
 
-typedef struct stack_item {
-    size_t branch_count;
-    size_t instruction;
-    label_t top;
-    label_t end;
-} stack_item_t;
+    options->eval_steps  = 1u << 20;
+    options->opt_level   = 2u;
+    options->outline_min = 16u;
+    options->putstr      = NULL;
+    options->cpu_tier    = cpu_tier_avx512;
+    options->cell_size   = 1u;
+}
 
-typedef struct instruction {
-    op_t      op;
-    ptrdiff_t val;
-    size_t    branch;
-} instruction_t;
+size_t interpret_analysis_steps(void) {
+    return analysis_steps;
+}
 
 const char * get_interpret_error_string(int return_code) {
     interpret_error_t err = return_code;
@@ -131,6 +1948,7 @@ const char * get_interpret_error_string(int return_code) {
     static const char msg_tape_under[] = "Tape underflow.";
     static const char msg_time_limit[] = "Time limit exceeded.";
     static const char msg_unbalanced[] = "Unbalanced number of '[' and ']'.";
+    static const char msg_cell_size[]  = "Unsupported cell size.";
     static const char msg_unknown[]    = "Unknown error.";
 
     switch (err) {
@@ -158,6 +1976,8 @@ const char * get_interpret_error_string(int return_code) {
             return msg_time_limit;
         case interpret_unbalanced:
             return msg_unbalanced;
+        case interpret_cell_size:
+            return msg_cell_size;
         default:
             return msg_unknown;
     }
@@ -165,6 +1985,59 @@ const char * get_interpret_error_string(int return_code) {
 
 int interpret(const char * program, size_t program_size, size_t max_data_size,
         const struct timeval * timelimit, getchar_t gcfp, putchar_t pcfp) {
+    return interpret_with_options(program, program_size, max_data_size,
+        timelimit, gcfp, pcfp, NULL);
+}
+
+/**
+ * Emits the coda, restoring the saved registers and returning 0.
+ */
+static void emit_coda(assembler_buffer_t buffer, uint32_t stack_adjust) {
+    /*
+     * addl (16 - saved * sizeof(uintptr_t) % 16), %esp
+     * popq %r15 ... %r12 (x86_64)
+     * popl %edi
+     * popl %ebx
+     * xorl %eax, %eax
+     * leave
+     * ret
+     */
+    if (stack_adjust > 0) {
+        emit_add_r_immz32(buffer, ESP, stack_adjust);
+    }
+    #if defined(HOST_ARCH_X64)
+    emit_pop_r(buffer, R15);
+    emit_pop_r(buffer, R14);
+    emit_pop_r(buffer, R13);
+    emit_pop_r(buffer, R12);
+    #endif
+    emit_pop_r(buffer, EDI);
+    emit_pop_r(buffer, EBX);
+    emit_xor_r_r(buffer, EAX, EAX);
+    emit_leave(buffer);
+    emit_ret(buffer);
+}
+
+int interpret_with_options(const char * program, size_t program_size,
+        size_t max_data_size, const struct timeval * timelimit,
+        getchar_t gcfp, putchar_t pcfp, const interpret_options_t * options) {
+    interpret_options_t defaults;
+    if (!(options)) {
+        interpret_default_options(&defaults);
+        options = &defaults;
+    }
+
+    put_char = pcfp;
+    put_str  = options->putstr;
+    get_char = gcfp;
+    analysis_steps = 0;
+
+    const unsigned cell_size = options->cell_size;
+    if (cell_size != 1 && cell_size != 2 && cell_size != 4) {
+        return interpret_cell_size;
+    }
+    const uint32_t mask = cell_mask(cell_size);
+
     /* Get page size */
     {
         long page_size_ = sysconf(_SC_PAGESIZE);
@@ -176,263 +2049,142 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
     }
 
     /**
-     * Perform a simple scan over the program contents to see how many jumps we
-     * need to have a stack for.
-     *
-     * The branch_count variable tracks how many actual branches ('[') we have
-     * and consequently, the number of indices we need to have on hand to track
-     * where to jump to.
-     */
-    size_t instruction;
-    size_t branch_count     = 0;
-    size_t stack_size       = 0;
-    size_t max_stack_size   = 0;
-    for (instruction = 0; instruction < program_size; instruction++) {
-        char inst = program[instruction];
-               if (inst == '[') {
-            branch_count++;
-            stack_size++;
-            if (stack_size > max_stack_size) {
-                max_stack_size = stack_size;
-            }
-        } else if (inst == ']') {
-            if (stack_size == 0) {
-                /*
-                 * The program is malformed.  For the initial prefix of
-                 * instructions on the range [0, instruction], it has more ']'
-                 * than '['.
-                 */
-                return interpret_unbalanced;
-            }
+     * Parse the program, optimize it at the requested level and link its
+     * loops.
+     */
+    program_t prog;
+    int prog_ret = parse_program(&prog, program, program_size);
+    if (prog_ret != interpret_ok) {
+        return prog_ret;
+    }
 
-            stack_size--;
-        }
+    const unsigned features =
+        cpu_features() & cpu_tier_features(options->cpu_tier);
+    prog.features = features;
+    prog.cell_size = cell_size;
+    prog.tape_size = max_data_size;
+
+    prog_ret = optimize_program(&prog, options->opt_level);
+    if (prog_ret == interpret_ok) {
+        prog_ret = link_program(&prog);
     }
+    if (prog_ret != interpret_ok) {
+        delete_program(&prog);
 
-    if (stack_size != 0) {
-        /* Unbalanced number of '[' and ']'. */
-        return interpret_unbalanced;
+        return prog_ret;
     }
 
+    instruction_t * const instructions = prog.instructions;
+    const size_t op_count = prog.count;
+    size_t op;
+
     /**
-     * Scan for number of distinct instructions (of differing op types)
+     * Assess the maximum distance traversed in either direction without
+     * interacting with the tape.  Within a straight-line block, cells are
+     * addressed relative to the pointer at its start, and the guarded copies
+     * may be shifted right by as much as the block reaches left, so we take
+     * the whole span of each block.
      */
-    op_t   last_op = op_invalid;
-    size_t op_count = 0u;
-    for (instruction = 0; instruction < program_size; instruction++) {
-        op_t next_op = op_invalid;
-        switch (program[instruction]) {
-            case '+':
-            case '-':
-                next_op = op_modify;
-                break;
-            case '>':
-                next_op = op_right;
-                break;
-            case '<':
-                next_op = op_left;
-                break;
-            case ',':
-                next_op = op_get;
-                break;
-            case '.':
-                next_op = op_put;
-                break;
-            case '[':
-                next_op = op_if;
-                break;
-            case ']':
-                next_op = op_endif;
-                break;
-            default:
-                break;
-        }
-
-        switch (next_op) {
-            case op_invalid:
-                /* Do nothing */
+    ptrdiff_t traverse_forward = 0, traverse_reverse = 0;
+    ptrdiff_t pos = 0, lo = 0, hi = 0;
+    for (op = 0; op <= op_count; op++) {
+        ptrdiff_t at = pos;
+        switch (op < op_count ? instructions[op].op : op_invalid) {
+            case op_right:
+                at = pos += instructions[op].val;
                 break;
-            case op_modify:
             case op_left:
-            case op_right:
-                if (last_op != next_op || last_op == op_invalid) {
-                    last_op = next_op;
-                    op_count++;
-                }
-
+                at = pos -= instructions[op].val;
                 break;
-            case op_get:
+            case op_modify:
+            case op_clear:
+            case op_set:
             case op_put:
-            case op_if:
-            case op_endif:
-                /* New instruction required */
-                last_op = next_op;
-                op_count++;
-                break;
-            default:
-                assert(0);
+            case op_get:
+            case op_mul:
+            case op_lane:
+                at = pos + instructions[op].offset;
                 break;
-        }
-    }
-
-    /**
-     * Allocate instruction space and condense instructions.
-     *
-     * Assess maximum distance traversed in either direction without
-     * interacting with the tape.
-     */
-    instruction_t * const instructions =
-        malloc(sizeof(instruction_t) * op_count);
-    if (!(instructions)) {
-        return interpret_malloc_error;
-    }
-
-    last_op = op_invalid;
-    size_t op = 0u;
-    for (instruction = 0; instruction < program_size; instruction++) {
-        switch (program[instruction]) {
-            case '+':
-                if (last_op == op_invalid) {
-                    instructions[op].op  = last_op = op_modify;
-                    instructions[op].val = 0;
-                } else if (last_op != op_modify) {
-                    op++;
-                    assert(op < op_count);
-
-                    instructions[op].op  = last_op = op_modify;
-                    instructions[op].val = 0;
-                }
-
-                instructions[op].val++;
+            case op_vadd:
+            case op_vstore:
+                /* Its lanes span the window. */
                 break;
-            case '-':
-                if (last_op == op_invalid) {
-                    instructions[op].op  = last_op = op_modify;
-                    instructions[op].val = 0;
-                } else if (last_op != op_modify) {
-                    op++;
-                    assert(op < op_count);
-
-                    instructions[op].op  = last_op = op_modify;
-                    instructions[op].val = 0;
-                }
-
-
-                instructions[op].val--;
+            case op_print:
+                /* It touches no cell. */
                 break;
-            case '>':
-                if (last_op == op_invalid) {
-                    instructions[op].op  = last_op = op_right;
-                    instructions[op].val = 0;
-                } else if (last_op != op_right) {
-                    op++;
-                    assert(op < op_count);
-
-                    instructions[op].op  = last_op = op_right;
-                    instructions[op].val = 0;
-                }
-
-                instructions[op].val++;
+            case op_divmod:
+                /* It reads as far as the loop's first step does. */
+                at = pos + 5;
                 break;
-            case '<':
-                if (last_op == op_invalid) {
-                    instructions[op].op  = last_op = op_left;
-                    instructions[op].val = 0;
-                } else if (last_op != op_left) {
-                    op++;
-                    assert(op < op_count);
-
-                    instructions[op].op  = last_op = op_left;
-                    instructions[op].val = 0;
+            case op_sweep:
+            case op_scan:
+                if (traverse_forward < instructions[op].val) {
+                    traverse_forward = instructions[op].val;
                 }
-
-                instructions[op].val++;
-                break;
-            case ',':
-                if (last_op != op_invalid) {
-                    op++;
-                    assert(op < op_count);
+                if (traverse_reverse < -instructions[op].val) {
+                    traverse_reverse = -instructions[op].val;
                 }
-
-                instructions[op].op  = last_op = op_get;
-                break;
-            case '.':
-                if (last_op != op_invalid) {
-                    op++;
-                    assert(op < op_count);
+                /* Fall through */
+            default:
+                /* The block ends. */
+                if (traverse_forward < hi - lo) {
+                    traverse_forward = hi - lo;
                 }
-
-                instructions[op].op  = last_op = op_put;
-                break;
-            case '[':
-                if (last_op != op_invalid) {
-                    op++;
-                    assert(op < op_count);
+                if (traverse_reverse < -lo) {
+                    traverse_reverse = -lo;
                 }
 
-                instructions[op].op  = last_op = op_if;
+                pos = lo = hi = at = 0;
                 break;
-            case ']':
-                if (last_op != op_invalid) {
-                    op++;
-                    assert(op < op_count);
-                }
+        }
 
-                instructions[op].op  = last_op = op_endif;
-                break;
-            default:
-                break;
+        if (at < lo) {
+            lo = at;
+        }
+        if (at > hi) {
+            hi = at;
         }
     }
 
-    assert(op_count == 0 || op == op_count - 1u);
+    /* We're going to overflow something.  The distances, and the tape, are
+     * in cells, each cell_size bytes. */
+    const size_t limit = (SIZE_MAX / 2 - page_size) / cell_size;
+    if (traverse_forward >= (ptrdiff_t) limit) {
+        delete_program(&prog);
 
-    ptrdiff_t traverse_forward = 0, traverse_reverse = 0;
-    for (op = 0; op < op_count; op++) {
-        switch (instructions[op].op) {
-            case op_left:
-                if (traverse_reverse < instructions[op].val) {
-                    traverse_reverse = instructions[op].val;
-                }
-                break;
-            case op_right:
-                if (traverse_forward < instructions[op].val) {
-                    traverse_forward = instructions[op].val;
-                }
-                break;
-            default:
-                break;
-        }
+        return interpret_guard_error;
     }
 
-    /* We're going to overflow something */
-    if (traverse_forward >= (ptrdiff_t) (SIZE_MAX / 2 - page_size)) {
-        free(instructions);
+    if (traverse_reverse >= (ptrdiff_t) limit) {
+        delete_program(&prog);
 
         return interpret_guard_error;
     }
 
-    if (traverse_reverse >= (ptrdiff_t) (SIZE_MAX / 2 - page_size)) {
-        free(instructions);
+    if (max_data_size >= limit) {
+        delete_program(&prog);
 
         return interpret_guard_error;
     }
 
     /* These casts are safe */
-    pages_forward  = (((size_t) traverse_forward) + page_size - 1) / page_size;
-    pages_reverse  = (((size_t) traverse_reverse) + page_size - 1) / page_size;
+    const size_t bytes_forward = (size_t) traverse_forward * cell_size;
+    const size_t bytes_reverse = (size_t) traverse_reverse * cell_size;
+    pages_forward  = (bytes_forward + page_size - 1) / page_size;
+    pages_reverse  = (bytes_reverse + page_size - 1) / page_size;
 
     /* Allocate:
      *
      * Round up to the nearest page size, if for some reason, we have >32kB
      * sized pages, and add two additional guard pages.
      */
-    size_t rnd  = (max_data_size + page_size - 1) & ~(page_size - 1);
+    size_t rnd  = (max_data_size * cell_size + page_size - 1) &
+        ~(page_size - 1);
     allocated   = rnd + (pages_forward + pages_reverse) * page_size;
     tape        = mmap( NULL, allocated, PROT_READ | PROT_WRITE, MAP_PRIVATE |
                         MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-    if (!(tape)) {
-        free(instructions);
+    if (tape == MAP_FAILED) {
+        delete_program(&prog);
 
         return interpret_mmap_error;
     }
@@ -442,14 +2194,16 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
         int ret;
         ret = mprotect(tape, pages_reverse * page_size, PROT_NONE);
         if (ret != 0) {
-            free(instructions);
+            delete_program(&prog);
+            munmap(tape, allocated);
 
             return interpret_guard_error;
         }
 
         ret = mprotect(tape + pages_reverse * page_size + rnd, pages_forward * page_size, PROT_NONE);
         if (ret != 0) {
-            free(instructions);
+            delete_program(&prog);
+            munmap(tape, allocated);
 
             return interpret_guard_error;
         }
@@ -471,18 +2225,21 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
      *  these variables.  They do not change between the calls to setjmp and
      *  longjmp.
      */
-    stack_item_t * stack =
-        malloc(sizeof(stack_item_t) * max_stack_size);
-    if (!(stack)) {
-        free(instructions);
-
-        return interpret_malloc_error;
-    }
+    size_t branch_count = prog.loop_count;
 
-    stack_item_t * branches =
-        malloc(sizeof(stack_item_t) * branch_count);
-    if (!(branches)) {
-        free(instructions);
+    /**
+     * Scratch state for the compilation comes from one arena, which is
+     * released along with it.  Labels live in the assembler buffer.
+     */
+    arena_t * arena = new_arena();
+    assembler_buffer_t buffer = new_assembler_buffer();
+    branch_t * branches = arena ?
+        arena_alloc(arena, sizeof(branch_t) * (branch_count + 1u)) : NULL;
+    if (!(buffer) || !(branches)) {
+        delete_program(&prog);
+        delete_assembler_buffer(buffer);
+        delete_arena(arena);
+        munmap(tape, allocated);
 
         return interpret_malloc_error;
     }
@@ -491,48 +2248,145 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
      * Create labels for each loop
      */
     for (op = 0; op < branch_count; op++) {
-        branches[op].top = new_label();
-        branches[op].end = new_label();
+        branches[op].head = NULL;
+        branches[op].top = new_label(buffer);
+        branches[op].end = new_label(buffer);
+        branches[op].stub = NULL;
+        branches[op].after = NULL;
     }
 
+    char * const tape_start = tape + pages_reverse * page_size;
+
     /**
-     * Scan the program once more, this time noting the position of all
-     * jumps, using the stack as a buffer.
+     * Run the program up to its first input at compile time.  The generated
+     * code picks up from wherever that stops, at the instruction resume.  The
+     * code for any loops already left behind is never emitted; first is the
+     * earliest instruction still reachable.
      */
-           branch_count = 0;
-    size_t stack_offset = 0;
-    for (op = 0; op < op_count; op++) {
-        op_t inst = instructions[op].op;
-               if (inst == op_if) {
-            stack[stack_offset].branch_count = branch_count;
-            stack_offset++;
-            assert(stack_offset <= max_stack_size);
+    size_t    resume = 0;
+    ptrdiff_t position = 0;
+    {
+        output_t output;
+        memset(&output, 0, sizeof(output));
+
+        int eval_ret = evaluate(&prog, tape_start,
+            rnd / cell_size, options->eval_steps, &resume, &position, &output);
+
+        if (options->putstr && output.size > 0) {
+            options->putstr(output.buffer, output.size);
+        } else {
+            size_t i;
+            for (i = 0; i < output.size; i++) {
+                pcfp((unsigned char) output.buffer[i]);
+            }
+        }
+        free(output.buffer);
 
-            branch_count++;
-        } else if (inst == op_endif) {
-            /* Program has already been checked. */
-            assert(stack_offset > 0);
+        if (eval_ret != interpret_ok) {
+            delete_program(&prog);
+            delete_assembler_buffer(buffer);
+            delete_arena(arena);
+            munmap(tape, allocated);
 
-            /* Pop off stack */
-            stack_offset--;
-            instructions[op].branch = stack[stack_offset].branch_count;
+            return eval_ret;
         }
     }
 
-    /**
-     * The stack is no longer needed.
-     */
-    free(stack);
+    size_t first = resume, depth = 0;
+    for (op = 0; op < resume; op++) {
+        if (instructions[op].op == op_if ||
+                instructions[op].op == op_fallback ||
+                instructions[op].op == op_cold) {
+            if (depth == 0) {
+                first = op;
+            }
+            depth++;
+        } else if (instructions[op].op == op_endif ||
+                instructions[op].op == op_join) {
+            depth--;
+        }
+    }
+    if (depth == 0) {
+        first = resume;
+    }
 
-    /**
-     * Create an assembler buffer.
+    size_t constant_count = 0, print_count = 0, clamp_count = 0, cold_count = 0;
+    for (op = first; op < op_count; op++) {
+        if (instructions[op].op == op_vadd ||
+                instructions[op].op == op_vstore) {
+            constant_count++;
+        } else if (instructions[op].op == op_print) {
+            print_count++;
+        } else if (instructions[op].op == op_left ||
+                instructions[op].op == op_scan) {
+            clamp_count++;
+        } else if (instructions[op].op == op_cold) {
+            cold_count++;
+        }
+    }
+
+    vector_constant_t * constants =
+        arena_alloc(arena, sizeof(vector_constant_t) * (constant_count + 1u));
+    size_t * outlined = arena_alloc(arena, sizeof(size_t) * (branch_count + 1u));
+    cell_cache_t * caches =
+        arena_alloc(arena, sizeof(cell_cache_t) * (branch_count + 1u));
+    int * fits = arena_alloc(arena, sizeof(int) * (branch_count + 1u));
+    size_t * fit_stack =
+        arena_alloc(arena, sizeof(size_t) * (prog.max_depth + 1u));
+    literal_t * literals =
+        arena_alloc(arena, sizeof(literal_t) * (print_count + 1u));
+    char * literal_data = arena_alloc(arena, print_count + 1u);
+    clamp_t * clamps = arena_alloc(arena, sizeof(clamp_t) * (clamp_count + 1u));
+    cold_region_t * colds =
+        arena_alloc(arena, sizeof(cold_region_t) * (cold_count + 1u));
+    int outline_ret = interpret_malloc_error;
+    if (constants && outlined && caches && fits && fit_stack && literals &&
+            literal_data && clamps && colds) {
+        memset(constants, 0, sizeof(vector_constant_t) * (constant_count + 1u));
+        memset(clamps, 0, sizeof(clamp_t) * (clamp_count + 1u));
+        outline_ret = outline_loops(&prog, first, resume,
+            options->outline_min, arena, outlined);
+    }
+    if (outline_ret != interpret_ok) {
+        delete_program(&prog);
+        delete_assembler_buffer(buffer);
+        delete_arena(arena);
+        munmap(tape, allocated);
+
+        return outline_ret;
+    }
+    constant_count = 0;
+    clamp_count = 0;
+    cold_count = 0;
+
+    /*
+     * Choose the loops whose cells are kept in registers.  Loops nested in a
+     * cached loop share its registers.
      */
-    assembler_buffer_t buffer = new_assembler_buffer();
+    fit_loops(&prog, outlined, fit_stack, fits);
+
+    size_t cached_close = SIZE_MAX;
+    for (op = 0; op < branch_count; op++) {
+        caches[op].count = 0;
+        if (prog.loops[op].open >= first && (cached_close == SIZE_MAX ||
+                prog.loops[op].open > cached_close)) {
+            cache_loop(&prog, op, resume, fits, &caches[op]);
+            if (caches[op].count > 0) {
+                cached_close = prog.loops[op].close;
+            }
+        }
+    }
+
+    for (op = 0; op < branch_count; op++) {
+        if (outlined[op] == op) {
+            branches[op].stub  = new_label(buffer);
+            branches[op].after = new_label(buffer);
+        }
+    }
 
     /**
      * Assemble.
      */
-    char * const tape_start = tape + pages_reverse * page_size;
 
     /* Write preamble
      *
@@ -541,153 +2395,300 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
      * andl -16, %esp
      * pushl %ebx
      * pushl %edi
-     * subl (16 - 2 * sizeof(uintptr_t)), %esp
+     * pushq %r12 ... %r15 (x86_64)
+     * subl (16 - saved * sizeof(uintptr_t) % 16), %esp
      */
     emit_push_r(buffer, EBP);
     emit_mov_r_r(buffer, EBP, ESP);
     emit_and_r_immz32(buffer, ESP, ~((uint32_t) 15));
 
-    /* Save EBX/EDI */
+    /* Save EBX/EDI, and on x86_64 the registers cells are cached in */
     emit_push_r(buffer, EBX);
     emit_push_r(buffer, EDI);
+    #if defined(HOST_ARCH_X64)
+    emit_push_r(buffer, R12);
+    emit_push_r(buffer, R13);
+    emit_push_r(buffer, R14);
+    emit_push_r(buffer, R15);
+    const size_t saved = 6u;
+    #else
+    const size_t saved = 2u;
+    #endif
     /* Align */
-    const uint32_t stack_adjust = 16u - 2u * sizeof(uintptr_t);
+    const uint32_t stack_adjust =
+        (uint32_t) ((16u - saved * sizeof(uintptr_t) % 16u) % 16u);
     if (stack_adjust > 0) {
         emit_sub_r_immz32(buffer, ESP, stack_adjust);
     }
 
     /* Pointer register */
     asm_register_t ptrreg = EBX;
-    emit_mov_r_immptr(buffer, ptrreg, (uintptr_t) tape_start);
-    branch_count = 0u;
-    for (op = 0; op < op_count; op++) {
+    emit_mov_r_immptr(buffer, ptrreg,
+        (uintptr_t) (tape_start + position * (ptrdiff_t) cell_size));
+
+    /*
+     * jmp resume
+     */
+    label_t resume_label = new_label(buffer);
+    if (resume != first) {
+        emit_jmp(buffer, resume_label);
+    }
+
+    /*
+     * The add of an op_modify to the current cell leaves ZF set exactly when
+     * the cell is zero, so a loop test directly after it needs no compare.
+     * flags_op is the last such instruction.  A test that can also be reached
+     * by a jump, as at the resume label or the top of a stub, keeps its
+     * compare.
+     */
+    size_t flags_op = SIZE_MAX;
+
+    /*
+     * The cells of the cached loop being emitted, if any, are in registers
+     * until it exits.
+     */
+    const cell_cache_t * cache = NULL;
+    asm_register_t cell;
+
+    /*
+     * Runs of constant output are gathered into literals.  The op_prints
+     * before print_end have been written with the run they belong to.
+     */
+    size_t literal_count = 0, literal_size = 0, print_end = 0;
+
+    /* The I/O trampolines, created along with their first call. */
+    label_t put_trampoline = NULL, literal_trampoline = NULL;
+    label_t get_trampoline = NULL;
+
+    /*
+     * The code runs from first to stop.  Once the code through op_count is
+     * out, followed by the coda, each cold region deferred along the way is
+     * emitted in turn, from its opener to its op_join.
+     */
+    size_t stop = op_count, cold_done = 0, cold_open = SIZE_MAX;
+    for (op = first; ; op++) {
+        if (op == stop) {
+            if (cold_open == SIZE_MAX) {
+                if (resume == op_count) {
+                    emit_push_label(buffer, resume_label);
+                }
+                emit_coda(buffer, stack_adjust);
+            }
+            if (cold_done == cold_count) {
+                break;
+            }
+
+            const cold_region_t * region = &colds[cold_done++];
+            cold_open = op = region->open;
+            stop      = prog.loops[instructions[op].branch].close + 1u;
+            cache     = region->cache;
+            flags_op  = SIZE_MAX;
+            print_end = 0;
+        }
+
+        if (op == resume) {
+            emit_push_label(buffer, resume_label);
+        }
+
+        const int flags_set = op > 0 && flags_op == op - 1 && op != resume;
+
         switch (instructions[op].op) {
             case op_right:
                 if (instructions[op].val == 0) {
                     break;
                 }
 
-                /* addl imm, %ptrreg */
-                emit_add_r_immz32(buffer, ptrreg, *(uint32_t *) &instructions[op].val);
+                /* leal imm(%ptrreg), %ptrreg, taking a disp8 for short moves */
+                emit_lea_r_rmdisp(buffer, ptrreg, ptrreg,
+                    cell_disp(instructions[op].val, cell_size));
                 break;
             case op_left:
                 if (instructions[op].val == 0) {
                     break;
                 }
 
-                {
-                /* cmpl imm, %ptrreg
-                 * jle minlabel
-                 * subl imm, %ptrreg
-                 * jmp finlabel
-                 * minlabel:
-                 * movl imm, %ptrreg
-                 * finlabel:
-                 */
-                label_t minlabel = new_label();
-                label_t finlabel = new_label();
+                emit_left(buffer, ptrreg, tape_start,
+                    instructions[op].val * (ptrdiff_t) cell_size,
+                    &clamps[clamp_count++]);
+                break;
+            case op_modify:
+                if (((uint32_t) instructions[op].val & mask) == 0) {
+                    break;
+                }
 
-                uintptr_t min_value = (uintptr_t) (tape_start + instructions[op].val);
-                if (sizeof(uintptr_t) == sizeof(uint32_t)) {
-                    emit_cmp_r_immz32(buffer, ptrreg, (uint32_t) min_value);
+                /* add r/m imm */
+                if (is_cached(cache, instructions[op].offset, &cell)) {
+                    emit_add_r8_imm8(buffer, cell,
+                        (uint8_t) instructions[op].val);
                 } else {
-                    /* x86_64 does not let us directly compare a register with a 64-bit
-                     * immediate, so we stash the value in RDI and compare from there. */
-                    emit_mov_r_immptr(buffer, EDI, min_value);
-                    emit_cmp_r_r(buffer, ptrreg, EDI);
+                    emit_cell_add_imm(buffer, cell_size, ptrreg,
+                        cell_disp(instructions[op].offset, cell_size),
+                        (uint32_t) instructions[op].val & mask);
                 }
-
-                emit_jle(buffer, minlabel);
-                emit_sub_r_immz32(buffer, ptrreg, *(uint32_t *) &instructions[op].val);
-                emit_jmp(buffer, finlabel);
-                emit_push_label(buffer, minlabel);
-                emit_mov_r_immptr(buffer, ptrreg, (uintptr_t) tape_start);
-                emit_push_label(buffer, finlabel);
+                if (instructions[op].offset == 0) {
+                    flags_op = op;
                 }
                 break;
-            case op_modify:
-                if ((instructions[op].val & 0xFF) == 0) {
-                    break;
+            case op_vadd:
+                #if defined(HOST_ARCH_X64)
+                emit_vadd(buffer, ptrreg, &prog, op,
+                    &constants[constant_count++]);
+                #else
+                assert(0);
+                #endif
+                break;
+            case op_vstore:
+                #if defined(HOST_ARCH_X64)
+                if (emit_vstore(buffer, ptrreg, &prog, op,
+                        &constants[constant_count])) {
+                    constant_count++;
                 }
-
-                /* add r/m8 imm8 */
-                emit_add_rm8_imm8(buffer, ptrreg, (uint8_t) (instructions[op].val & 0xFF));
+                #else
+                assert(0);
+                #endif
                 break;
-            case op_put:
+            case op_lane:
+                /* Handled by the preceding op_vadd or op_vstore. */
+                break;
+            case op_clear:
+            case op_set:
+                /* mov r/m imm */
+                if (is_cached(cache, instructions[op].offset, &cell)) {
+                    emit_mov_r8_imm8(buffer, cell,
+                        (uint8_t) instructions[op].val);
+                } else {
+                    emit_cell_store_imm(buffer, cell_size, ptrreg,
+                        cell_disp(instructions[op].offset, cell_size),
+                        (uint32_t) instructions[op].val & mask);
+                }
+                break;
+            case op_mul:
+                emit_mul(buffer, ptrreg, &prog, op, cache);
+                break;
+            case op_guard:
+                {
                 /*
-                 * xorl %eax, %eax
-                 * movl (%ptrreg), %al
+                 * cmpl tape_start + val * cell_size - 1, %ptrreg
+                 * jle head
                  */
-                emit_xor_r_r(buffer, EAX, EAX);
-                emit_mov_r8_rm8(buffer, EAX, ptrreg);
+                branch_t * fallback = &branches[instructions[op].branch];
+                if (!(fallback->head)) {
+                    fallback->head = new_label(buffer);
+                }
 
+                emit_cmp_ptr(buffer, ptrreg, (uintptr_t) (tape_start +
+                    instructions[op].val * (ptrdiff_t) cell_size - 1));
+                emit_jle(buffer, fallback->head);
+                }
+                break;
+            case op_divmod:
+                emit_divmod(buffer, ptrreg);
+                break;
+            case op_select:
+                /* The body is emitted with it, and never resumed into. */
+                assert(resume <= op ||
+                    resume > op + (size_t) instructions[op].val);
+                emit_select(buffer, ptrreg, &instructions[op], cell_size);
+                op += (size_t) instructions[op].val;
+                break;
+            case op_scan:
+                emit_scan(buffer, ptrreg, tape_start, instructions[op].val,
+                    &clamps[clamp_count++], features, cell_size);
+                break;
+            case op_sweep:
+                assert(instructions[op].val == 1);
+                emit_sweep(buffer, ptrreg, features, cell_size);
+                break;
+            case op_put:
+                /* Only the low byte of a cell, its first, is written. */
                 #if   defined(HOST_ARCH_X64)
                 /*
-                 * movl %rax, %rdi
+                 * movzbl offset(%ptrreg), %edi
                  */
-                emit_mov_r_r(buffer, EDI, EAX);
+                emit_movzx_r_rm8disp(buffer, EDI, ptrreg,
+                    cell_disp(instructions[op].offset, cell_size));
                 #elif defined(HOST_ARCH_IA32)
                 /*
-                 * movl %al, (%esp)
+                 * movzbl offset(%ptrreg), %eax
+                 * movl %eax, (%esp)
                  */
+                emit_movzx_r_rm8disp(buffer, EAX, ptrreg,
+                    cell_disp(instructions[op].offset, cell_size));
                 emit_mov_rm_rint(buffer, ESP, EAX);
                 #else
                 #error Unsupported architecture.
                 #endif
 
-                /* call *pcfp */
-                emit_call(buffer, (uintptr_t) pcfp);
+                /* call put */
+                if (!(put_trampoline)) {
+                    put_trampoline = new_label(buffer);
+                }
+                emit_call_label(buffer, put_trampoline);
                 break;
-            case op_get:
+            case op_print:
                 {
-                /*
-                 * call *gcfp
-                 * cmpl eax, EOF
-                 * jne eoflabel
-                 * xorl eax, eax
-                 * eoflabel: movl r/m8 r8
-                 */
-                label_t eof_label = new_label();
-                assert(eof_label);
-
-                union {
-                    int32_t i;
-                    uint32_t u;
-                } u;
-
-                u.i = EOF;
+                if (op < print_end) {
+                    /* Written with the run it belongs to. */
+                    break;
+                }
 
-                emit_call(buffer, (uintptr_t) gcfp);
-                emit_cmp_r_immz32(buffer, EAX, u.u);
-                emit_jne(buffer, eof_label);
-                emit_xor_r_r(buffer, EAX, EAX);
-                emit_push_label(buffer, eof_label);
-                emit_mov_rm8_r8(buffer, ptrreg, EAX);
+                literal_t * literal = &literals[literal_count];
+                print_end = emit_print(buffer, &prog, op, resume, literal,
+                    literal_data + literal_size, &put_trampoline,
+                    &literal_trampoline);
+                literal_size += literal->size;
+                if (literal->size > 1) {
+                    literal_count++;
+                }
                 }
                 break;
-            case op_if:
+            case op_get:
                 /*
-                 * cmp r/m8 0
-                 * je end
-                 * top:
+                 * call get
+                 * movb %al, offset(%ptrreg) (%ax, %eax)
+                 *
+                 * get_byte has already turned EOF into 0, and zero extended
+                 * the byte.
                  */
-                emit_cmp_rm8_imm8(buffer, ptrreg, 0);
-
-                assert(branches[branch_count].end);
-                emit_je(buffer, branches[branch_count].end);
-                emit_push_label(buffer, branches[branch_count].top);
+                if (!(get_trampoline)) {
+                    get_trampoline = new_label(buffer);
+                }
+                emit_call_label(buffer, get_trampoline);
+                emit_cell_store_r(buffer, cell_size, ptrreg,
+                    cell_disp(instructions[op].offset, cell_size), EAX);
+                break;
+            case op_if:
+                if (emit_if(buffer, ptrreg, &prog, instructions[op].branch,
+                        branches, outlined, caches, &cache, flags_set)) {
+                    /* A copy of an outlined loop, which was only called. */
+                    op = prog.loops[instructions[op].branch].close;
+                }
+                break;
+            case op_fallback:
+                emit_fallback(buffer, ptrreg, &prog, instructions[op].branch,
+                    branches);
+                break;
+            case op_cold:
+                /* Leave the region for later, resuming at its op_join. */
+                if (op != cold_open) {
+                    colds[cold_count].open  = op;
+                    colds[cold_count].cache = cache;
+                    cold_count++;
+
+                    op = prog.loops[instructions[op].branch].close - 1u;
+                    break;
+                }
 
-                branch_count++;
+                emit_cold(buffer, instructions[op].branch, branches);
+                break;
+            case op_join:
+                emit_join(buffer, instructions[op].branch, branches,
+                    cold_open != SIZE_MAX && instructions[op].branch ==
+                        instructions[cold_open].branch);
                 break;
             case op_endif:
-                /*
-                 * cmp r/m8 0
-                 * jne top
-                 * end:
-                 */
-                emit_cmp_rm8_imm8(buffer, ptrreg, 0);
-                emit_jne(buffer, branches[instructions[op].branch].top);
-                emit_push_label(buffer, branches[instructions[op].branch].end);
+                emit_endif(buffer, ptrreg, &prog, instructions[op].branch,
+                    branches, outlined, caches, &cache, flags_set);
                 break;
             default:
                 assert(0);
@@ -695,37 +2696,78 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
         }
     }
 
-    /* Coda, restore EBX and leave.
+    emit_trampoline(buffer, put_trampoline, (uintptr_t) pcfp);
+    emit_trampoline(buffer, literal_trampoline, (uintptr_t) put_literal);
+    emit_trampoline(buffer, get_trampoline, (uintptr_t) get_byte);
+
+    /*
+     * The clamps, out of the way of the code that branches to them:
      *
-     * addl (16 - 2 * sizeof(uintptr_t)), %esp
-     * popl %edi
-     * popl %ebx
-     * xorl %eax, %eax
-     * leave
-     * ret
+     * clamp:
+     * vzeroupper (after an AVX2 scan)
+     * movl tape_start, %ptrreg
+     * spin: (for a scan)
+     * cmp r/m 0
+     * jne spin
+     * jmp resume
      */
-    if (stack_adjust > 0) {
-        emit_add_r_immz32(buffer, ESP, stack_adjust);
+    for (op = 0; op < clamp_count; op++) {
+        const clamp_t * clamp = &clamps[op];
+        if (!(clamp->label)) {
+            /* A forward scan never clamps. */
+            continue;
+        }
+
+        emit_push_label(buffer, clamp->label);
+        if (clamp->vzeroupper) {
+            emit_vzeroupper(buffer);
+        }
+        emit_mov_r_immptr(buffer, clamp->reg, (uintptr_t) tape_start);
+        if (clamp->spin) {
+            label_t spin = new_label(buffer);
+            emit_push_label(buffer, spin);
+            emit_cell_cmp_zero(buffer, cell_size, clamp->reg, 0);
+            emit_jne(buffer, spin);
+        }
+        emit_jmp(buffer, clamp->resume);
+    }
+
+    /*
+     * Constants for the vector adds.  paddb requires its 16 bytes aligned, and
+     * none should straddle a cache line.  Without AVX-512, no window is wider
+     * than 32 bytes.
+     */
+    const size_t constant_size = (features & cpu_avx512bw) ? 64u : 32u;
+    if (constant_count > 0) {
+        emit_align(buffer, constant_size);
     }
-    emit_pop_r(buffer, EDI);
-    emit_pop_r(buffer, EBX);
-    emit_xor_r_r(buffer, EAX, EAX);
-    emit_leave(buffer);
-    emit_ret(buffer);
 
-    /* Cleanup instructions and branches lists */
-    free(instructions);
-    free(branches);
+    for (op = 0; op < constant_count; op++) {
+        emit_push_label(buffer, constants[op].label);
+        emit_data(buffer, constants[op].bytes, constant_size);
+    }
+
+    /* Cleanup instructions, branches and constants lists */
+    delete_program(&prog);
 
     /* Finalize assembly */
     typedef void (*vv_t)(void);
     vv_t entry_point = (vv_t) finalize_assembler_buffer(buffer);
+    if (!(entry_point)) {
+        const int out_of_memory = is_out_of_memory(buffer);
+        delete_assembler_buffer(buffer);
+        delete_arena(arena);
+        munmap(tape, allocated);
+
+        return out_of_memory ? interpret_malloc_error : interpret_mmap_error;
+    }
 
     /* Storage for the old SIGSEGV handler. */
     struct sigaction old_sigsegv, old_vtalarm;
 
-    /* Configure a restoration environment */
-    int ret = setjmp(env);
+    /* Configure a restoration environment.  The signal mask is saved as well,
+     * so SIGSEGV is not left blocked after we jump out of its handler. */
+    int ret = sigsetjmp(env, 1);
 
     /**
      * Set handler and interpret.
@@ -742,8 +2784,9 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
 
         int sig_ret = sigaction(SIGSEGV, &act_sigsegv, &old_sigsegv);
         if (sig_ret != 0) {
-            free(instructions);
             delete_assembler_buffer(buffer);
+            delete_arena(arena);
+            munmap(tape, allocated);
 
             return interpret_handler;
         }
@@ -751,8 +2794,9 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
         if (timelimit) {
             sig_ret = sigaction(SIGVTALRM, &act_vtalarm, &old_vtalarm);
             if (sig_ret != 0) {
-                free(instructions);
                 delete_assembler_buffer(buffer);
+                delete_arena(arena);
+                munmap(tape, allocated);
 
                 return interpret_handler;
             }
@@ -763,8 +2807,9 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
 
             int timer_ret = setitimer(ITIMER_VIRTUAL, &timer, NULL);
             if (timer_ret != 0) {
-                free(instructions);
                 delete_assembler_buffer(buffer);
+                delete_arena(arena);
+                munmap(tape, allocated);
 
                 return interpret_handler;
             }
@@ -782,6 +2827,7 @@ int interpret(const char * program, size_t program_size, size_t max_data_size,
 
     /* This should cleanup the labels. */
     delete_assembler_buffer(buffer);
+    delete_arena(arena);
 
     /* Cleanup tape */
     if (munmap(tape, allocated) != 0) {
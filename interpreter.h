@@ -23,6 +23,7 @@
 
 typedef int (*getchar_t)(void);
 typedef int (*putchar_t)(int);
+typedef void (*putstr_t)(const char * str, size_t size);
 
 typedef enum interpret_error {
     interpret_ok                = 0,
@@ -36,14 +37,65 @@ typedef enum interpret_error {
     interpret_tape_exceeded     = 8,
     interpret_tape_underflow    = 9,
     interpret_time_exceeded     = 10,
-    interpret_unbalanced        = 11
+    interpret_unbalanced        = 11,
+    interpret_cell_size         = 12
 } interpret_error_t;
 
 /* Forward declaration. */
 struct timeval;
 
+/**
+ * Tuning for interpret_with_options.  Start from interpret_default_options.
+ *
+ * eval_steps bounds how many instructions are run at compile time, before the
+ * program first reads input.  Zero disables compile-time evaluation.
+ *
+ * opt_level selects the optimization passes run before compiling:  0 runs
+ * none, 1 only the cheap pattern rewrites, and 2 (the default) everything,
+ * including constant propagation, unrolling and vectorization.  Loops known
+ * to run at most once lose their back-edge, and become branch-free selects,
+ * from level 1 on.
+ *
+ * outline_min is the fewest instructions a loop must have to be emitted just
+ * once, as a stub shared by all of its copies, rather than at each copy.
+ * Smaller loops are not worth the call.  Zero disables outlining.
+ *
+ * putstr, if not NULL, is handed runs of output known at compile time,
+ * including whatever compile-time evaluation prints, in a single call each.
+ * Otherwise their bytes go to the program's putchar one at a time.
+ *
+ * cpu_tier, one of the cpu_tier_t in cpu.h, caps the instruction set
+ * extensions the generated code may use.  The default, cpu_tier_avx512,
+ * allows whatever the host supports.
+ *
+ * cell_size is the width of a cell in bytes:  1 (the default), 2 or 4.  Cells
+ * wrap modulo 2 to the power of their bits, and max_data_size counts cells
+ * rather than bytes.  Input is zero extended into a cell, and output writes
+ * the low byte of one.
+ */
+typedef struct interpret_options {
+    size_t   eval_steps;
+    unsigned opt_level;
+    size_t   outline_min;
+    putstr_t putstr;
+    unsigned cpu_tier;
+    unsigned cell_size;
+} interpret_options_t;
+
+void interpret_default_options(interpret_options_t * options);
+
 int interpret(const char * program, size_t program_size, size_t max_data_size,
     const struct timeval * timelimit, getchar_t gcfp, putchar_t pcfp);
+int interpret_with_options(const char * program, size_t program_size,
+    size_t max_data_size, const struct timeval * timelimit, getchar_t gcfp,
+    putchar_t pcfp, const interpret_options_t * options);
 const char * get_interpret_error_string(int return_code);
 
+/*
+ * The number of instructions examined while choosing the loops to outline
+ * and to cache during the last compile.  It grows linearly with the program,
+ * so tests may bound the compiler's work without timing it.
+ */
+size_t interpret_analysis_steps(void);
+
 #endif // __BF__INTERPRETER_H__
@@ -0,0 +1,481 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "interpreter.h"
+#include "ir.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t cell_mask(unsigned cell_size) {
+    assert(cell_size == 1 || cell_size == 2 || cell_size == 4);
+    return cell_size == 4 ? UINT32_MAX :
+        (uint32_t) ((UINT32_C(1) << (8u * cell_size)) - 1u);
+}
+
+int parse_program(program_t * program, const char * source, size_t size) {
+    assert(program);
+    memset(program, 0, sizeof(*program));
+
+    /**
+     * Perform a simple scan over the program contents to check that its
+     * brackets balance.
+     */
+    size_t instruction;
+    size_t stack_size       = 0;
+    for (instruction = 0; instruction < size; instruction++) {
+        char inst = source[instruction];
+               if (inst == '[') {
+            stack_size++;
+        } else if (inst == ']') {
+            if (stack_size == 0) {
+                /*
+                 * The program is malformed.  For the initial prefix of
+                 * instructions on the range [0, instruction], it has more ']'
+                 * than '['.
+                 */
+                return interpret_unbalanced;
+            }
+
+            stack_size--;
+        }
+    }
+
+    if (stack_size != 0) {
+        /* Unbalanced number of '[' and ']'. */
+        return interpret_unbalanced;
+    }
+
+    /**
+     * Scan for number of distinct instructions (of differing op types)
+     */
+    op_t   last_op = op_invalid;
+    size_t op_count = 0u;
+    for (instruction = 0; instruction < size; instruction++) {
+        op_t next_op = op_invalid;
+        switch (source[instruction]) {
+            case '+':
+            case '-':
+                next_op = op_modify;
+                break;
+            case '>':
+                next_op = op_right;
+                break;
+            case '<':
+                next_op = op_left;
+                break;
+            case ',':
+                next_op = op_get;
+                break;
+            case '.':
+                next_op = op_put;
+                break;
+            case '[':
+                next_op = op_if;
+                break;
+            case ']':
+                next_op = op_endif;
+                break;
+            default:
+                break;
+        }
+
+        switch (next_op) {
+            case op_invalid:
+                /* Do nothing */
+                break;
+            case op_modify:
+            case op_left:
+            case op_right:
+                if (last_op != next_op || last_op == op_invalid) {
+                    last_op = next_op;
+                    op_count++;
+                }
+
+                break;
+            case op_get:
+            case op_put:
+            case op_if:
+            case op_endif:
+                /* New instruction required */
+                last_op = next_op;
+                op_count++;
+                break;
+            default:
+                assert(0);
+                break;
+        }
+    }
+
+    /**
+     * Allocate instruction space and condense instructions.
+     *
+     * Assess maximum distance traversed in either direction without
+     * interacting with the tape.
+     */
+    instruction_t * instructions =
+        calloc(op_count + 1u, sizeof(instruction_t));
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    last_op = op_invalid;
+    size_t op = 0u;
+    for (instruction = 0; instruction < size; instruction++) {
+        switch (source[instruction]) {
+            case '+':
+                if (last_op == op_invalid) {
+                    instructions[op].op  = last_op = op_modify;
+                    instructions[op].val = 0;
+                } else if (last_op != op_modify) {
+                    op++;
+                    assert(op < op_count);
+
+                    instructions[op].op  = last_op = op_modify;
+                    instructions[op].val = 0;
+                }
+
+                instructions[op].val++;
+                break;
+            case '-':
+                if (last_op == op_invalid) {
+                    instructions[op].op  = last_op = op_modify;
+                    instructions[op].val = 0;
+                } else if (last_op != op_modify) {
+                    op++;
+                    assert(op < op_count);
+
+                    instructions[op].op  = last_op = op_modify;
+                    instructions[op].val = 0;
+                }
+
+
+                instructions[op].val--;
+                break;
+            case '>':
+                if (last_op == op_invalid) {
+                    instructions[op].op  = last_op = op_right;
+                    instructions[op].val = 0;
+                } else if (last_op != op_right) {
+                    op++;
+                    assert(op < op_count);
+
+                    instructions[op].op  = last_op = op_right;
+                    instructions[op].val = 0;
+                }
+
+                instructions[op].val++;
+                break;
+            case '<':
+                if (last_op == op_invalid) {
+                    instructions[op].op  = last_op = op_left;
+                    instructions[op].val = 0;
+                } else if (last_op != op_left) {
+                    op++;
+                    assert(op < op_count);
+
+                    instructions[op].op  = last_op = op_left;
+                    instructions[op].val = 0;
+                }
+
+                instructions[op].val++;
+                break;
+            case ',':
+                if (last_op != op_invalid) {
+                    op++;
+                    assert(op < op_count);
+                }
+
+                instructions[op].op  = last_op = op_get;
+                break;
+            case '.':
+                if (last_op != op_invalid) {
+                    op++;
+                    assert(op < op_count);
+                }
+
+                instructions[op].op  = last_op = op_put;
+                break;
+            case '[':
+                if (last_op != op_invalid) {
+                    op++;
+                    assert(op < op_count);
+                }
+
+                instructions[op].op  = last_op = op_if;
+                instructions[op].val = 0;
+                break;
+            case ']':
+                if (last_op != op_invalid) {
+                    op++;
+                    assert(op < op_count);
+                }
+
+                instructions[op].op  = last_op = op_endif;
+                instructions[op].val = 0;
+                break;
+            default:
+                break;
+        }
+    }
+
+    assert(op_count == 0 || op == op_count - 1u);
+
+    program->instructions   = instructions;
+    program->count          = op_count;
+    program->cell_size      = 1u;
+    program->tape_size      = SIZE_MAX;
+    return interpret_ok;
+}
+
+int link_program(program_t * program) {
+    assert(program);
+    instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+
+    /* Count the loops and how deeply they nest. */
+    size_t op;
+    size_t branch_count     = 0;
+    size_t stack_size       = 0;
+    size_t max_stack_size   = 0;
+    for (op = 0; op < op_count; op++) {
+        if (instructions[op].op == op_if ||
+                instructions[op].op == op_fallback ||
+                instructions[op].op == op_cold) {
+            branch_count++;
+            stack_size++;
+            if (stack_size > max_stack_size) {
+                max_stack_size = stack_size;
+            }
+        } else if (instructions[op].op == op_endif ||
+                instructions[op].op == op_join) {
+            assert(stack_size > 0);
+            stack_size--;
+        }
+    }
+
+    size_t * stack = malloc(sizeof(size_t) * (max_stack_size + 1u));
+    if (!(stack)) {
+        return interpret_malloc_error;
+    }
+
+    loop_t * loops = realloc(program->loops,
+        sizeof(loop_t) * (branch_count + 1u));
+    if (!(loops)) {
+        free(stack);
+        return interpret_malloc_error;
+    }
+
+    /**
+     * Note the position of all jumps, using the stack as a buffer.
+     */
+           branch_count = 0;
+    size_t stack_offset = 0;
+    for (op = 0; op < op_count; op++) {
+        op_t inst = instructions[op].op;
+               if (inst == op_guard) {
+            /* The guard always precedes its fallback loop. */
+            instructions[op].branch = branch_count;
+        } else if (inst == op_if || inst == op_fallback || inst == op_cold) {
+            stack[stack_offset] = branch_count;
+            stack_offset++;
+            assert(stack_offset <= max_stack_size);
+
+            instructions[op].branch = branch_count;
+            loops[branch_count].open = op;
+            branch_count++;
+        } else if (inst == op_endif || inst == op_join) {
+            assert(stack_offset > 0);
+
+            /* Pop off stack */
+            stack_offset--;
+            instructions[op].branch = stack[stack_offset];
+            loops[instructions[op].branch].close = op;
+        }
+    }
+
+    free(stack);
+
+    program->loops          = loops;
+    program->loop_count     = branch_count;
+    program->max_depth      = max_stack_size;
+    return interpret_ok;
+}
+
+/**
+ * Folds an instruction into the hash of the loop holding it.
+ */
+static size_t hash_instruction(size_t hash, const instruction_t * inst) {
+    hash = (hash ^ (size_t) inst->op)     * 16777619u;
+    hash = (hash ^ (size_t) inst->val)    * 16777619u;
+    hash = (hash ^ (size_t) inst->offset) * 16777619u;
+    return hash;
+}
+
+static int is_opener(op_t op) {
+    return op == op_if || op == op_fallback || op == op_cold;
+}
+
+/**
+ * Returns nonzero if loops a and b have the same instructions.  Their nested
+ * loops have already been matched, so each is compared by its twin rather
+ * than instruction by instruction.
+ */
+static int same_loop(const program_t * program, const size_t * twins,
+        size_t a, size_t b, size_t * steps) {
+    const loop_t * la = &program->loops[a];
+    const loop_t * lb = &program->loops[b];
+    if (la->close - la->open != lb->close - lb->open) {
+        return 0;
+    }
+
+    const instruction_t * x = &program->instructions[la->open];
+    const instruction_t * y = &program->instructions[lb->open];
+    size_t i;
+    for (i = 0; i <= la->close - la->open; i++) {
+        (*steps)++;
+        if (x[i].op != y[i].op || x[i].val != y[i].val ||
+                x[i].offset != y[i].offset) {
+            return 0;
+        }
+
+        if (i > 0 && is_opener(x[i].op)) {
+            if (twins[x[i].branch] != twins[y[i].branch]) {
+                return 0;
+            }
+
+            /* Twins are the same length:  skip to their closers. */
+            i = program->loops[x[i].branch].close - la->open;
+        }
+    }
+
+    return 1;
+}
+
+int match_loops(const program_t * program, size_t * twins, int * leaves,
+        size_t * steps) {
+    assert(program);
+    assert(twins);
+    assert(leaves);
+    assert(steps);
+
+    const size_t loop_count = program->loop_count;
+    size_t buckets = 1u;
+    while (buckets < 2u * loop_count) {
+        buckets *= 2u;
+    }
+
+    /*
+     * hashes[i] is the hash of loop i so far, and reach[i] the furthest
+     * opener of a fallback that a guard within it branches to.  stack holds
+     * the loops open at each instruction.
+     */
+    size_t * table = malloc(sizeof(size_t) *
+        (buckets + 2u * loop_count + program->max_depth + 1u));
+    if (!(table)) {
+        return interpret_malloc_error;
+    }
+    size_t * hashes = table + buckets;
+    size_t * reach  = hashes + loop_count;
+    size_t * stack  = reach + loop_count;
+
+    size_t i;
+    for (i = 0; i < buckets; i++) {
+        table[i] = SIZE_MAX;
+    }
+
+    /*
+     * Each loop is hashed as its closer is reached, after every loop nested
+     * in it, whose hashes stand in for their instructions.  leaves[i] only
+     * notes I/O until then, as that alone carries to the enclosing loop.
+     */
+    size_t depth = 0, op;
+    for (op = 0; op < program->count; op++) {
+        const instruction_t * inst = &program->instructions[op];
+        (*steps)++;
+        if (is_opener(inst->op)) {
+            assert(depth <= program->max_depth);
+            hashes[inst->branch] = hash_instruction(2166136261u, inst);
+            reach[inst->branch]  = 0;
+            leaves[inst->branch] = 0;
+            stack[depth++] = inst->branch;
+            continue;
+        } else if (depth == 0) {
+            continue;
+        }
+
+        const size_t loop = stack[depth - 1u];
+        hashes[loop] = hash_instruction(hashes[loop], inst);
+        switch (inst->op) {
+            case op_put:
+            case op_get:
+            case op_print:
+                leaves[loop] = 1;
+                break;
+            case op_guard:
+                if (program->loops[inst->branch].open > reach[loop]) {
+                    reach[loop] = program->loops[inst->branch].open;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (inst->op != op_endif && inst->op != op_join) {
+            continue;
+        }
+
+        /* Open addressing, with linear probing. */
+        size_t slot = hashes[loop] & (buckets - 1u);
+        while (table[slot] != SIZE_MAX &&
+                !(same_loop(program, twins, table[slot], loop, steps))) {
+            slot = (slot + 1u) & (buckets - 1u);
+        }
+
+        if (table[slot] == SIZE_MAX) {
+            table[slot] = loop;
+        }
+        twins[loop] = table[slot];
+
+        depth--;
+        if (depth > 0) {
+            const size_t parent = stack[depth - 1u];
+            hashes[parent] = (hashes[parent] ^ hashes[loop]) * 16777619u;
+            leaves[parent] |= leaves[loop];
+            if (reach[loop] > reach[parent]) {
+                reach[parent] = reach[loop];
+            }
+        }
+
+        if (reach[loop] > program->loops[loop].close) {
+            leaves[loop] = 1;
+        }
+    }
+
+    free(table);
+    return interpret_ok;
+}
+
+void delete_program(program_t * program) {
+    assert(program);
+
+    free(program->instructions);
+    free(program->loops);
+    memset(program, 0, sizeof(*program));
+}
@@ -0,0 +1,136 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BF__IR_H__
+#define __BF__IR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum op {
+    op_modify                 = '+',
+    op_right                  = '>',
+    op_left                   = '<',
+    op_get                    = ',',
+    op_put                    = '.',
+    op_if                     = '[',
+    op_endif                  = ']',
+    op_clear                  = '0',
+    op_set                    = '=',
+    op_mul                    = '*',
+    op_guard                  = '?',
+    op_fallback               = '{',
+    op_scan                   = '@',
+    op_cold                   = '(',
+    op_join                   = ')',
+    op_vadd                   = 'v',
+    op_vstore                 = 'V',
+    op_lane                   = 'l',
+    op_sweep                  = '_',
+    op_select                 = 's',
+    op_divmod                 = '/',
+    op_print                  = '"',
+    op_invalid                = '\0'
+} op_t;
+
+/**
+ * Cell accesses (op_modify, op_clear, op_set, op_put and op_get) address the
+ * cell offset cells from the pointer.  op_mul adds val times the current cell
+ * to the cell at offset.  op_guard branches to the following op_fallback loop
+ * or op_cold block if the pointer is within val cells of the start of the
+ * tape.  op_fallback opens a loop that is only reachable from such a guard,
+ * and op_cold ... op_join brackets straight-line code that is likewise only
+ * reachable from a guard.  op_scan moves the pointer by val until it reaches
+ * a zero cell.  op_if with a nonzero val is known to be entered and op_endif
+ * with a nonzero val is known to exit, so neither need test its cell.  op_right
+ * with a negative val moves the pointer left without clamping, where a guard
+ * has shown that it cannot reach the start of the tape.  op_vadd adds the
+ * op_lane modifications that follow it to the val cells starting at offset
+ * with a single vector instruction, and op_vstore likewise stores its op_lane
+ * values; each op_lane otherwise acts as op_modify or op_set.  op_sweep clears
+ * cells, moving the pointer right, until it reaches a zero cell.  op_select
+ * runs the val instructions that follow it only if the current cell is
+ * nonzero, standing in for a loop known to run at most once; it is not a
+ * loop, and the code generated for it does not branch.  op_divmod precedes
+ * the divmod loop [->-[>+>>]>[+[-<+>]>+>>]<<<<<] and finishes it with a
+ * single division when its cells are as the loop expects:  the cells at
+ * offsets 1 and 2 hold a nonzero count down and a count up summing to a
+ * divisor from 2 to 255, and those at offsets 4 and 5 are zero.  Otherwise it
+ * does nothing, leaving the loop to run.  op_print outputs the constant val,
+ * standing in for an op_put of a cell known to hold it.
+ */
+typedef struct instruction {
+    op_t      op;
+    ptrdiff_t val;
+    ptrdiff_t offset;
+    size_t    branch;
+} instruction_t;
+
+/**
+ * A loop, or a region only reachable from a guard, by the indices of the
+ * instructions that open and close it.
+ */
+typedef struct loop {
+    size_t open;
+    size_t close;
+} loop_t;
+
+/**
+ * A program as a flat list of instructions.  Once linked, each opener and
+ * closer (and each guard, for the region that follows it) carries the index of
+ * its loop in branch, and max_depth is how deeply the loops nest.
+ *
+ * features, the cpu_feature_t the program will be compiled for, lets the
+ * passes shape their output to the widest vectors available.  cell_size is
+ * the width of a cell in bytes, 1, 2 or 4; cells wrap modulo 2 to the power
+ * of its bits, and passes that reason in bytes only rewrite 1-byte cells.
+ * tape_size is the number of cells on the tape:  touching any past it faults,
+ * and the passes must not drop such an access.
+ */
+typedef struct program {
+    instruction_t * instructions;
+    size_t          count;
+    loop_t *        loops;
+    size_t          loop_count;
+    size_t          max_depth;
+    unsigned        features;
+    unsigned        cell_size;
+    size_t          tape_size;
+} program_t;
+
+/**
+ * Returns the mask of the bits of a cell cell_size bytes wide.
+ */
+uint32_t cell_mask(unsigned cell_size);
+
+int  parse_program(program_t * program, const char * source, size_t size);
+int  link_program(program_t * program);
+int  optimize_program(program_t * program, unsigned level);
+void delete_program(program_t * program);
+
+/**
+ * Hash-conses a linked program's loops in one pass:  twins[i] is set to the
+ * first loop whose instructions, nested loops included, are the same as those
+ * of loop i.  leaves[i] is set nonzero if loop i, nested loops included, does
+ * I/O or holds a guard whose fallback lies outside it.  steps is increased by
+ * the number of instructions examined.
+ */
+int  match_loops(const program_t * program, size_t * twins, int * leaves,
+    size_t * steps);
+
+#endif // __BF__IR_H__
@@ -16,8 +16,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "cpu.h"
 #include "interpreter.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include "test.h"
 
 int main(int argc, char **argv) {
@@ -273,5 +275,795 @@ int main(int argc, char **argv) {
         }
     }
 
+    {
+        /* "\0\3" */
+        const char program[] = "+++++[-].++[+]+++.";
+        const char output[]  = {0x0, 0x3, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 19;
+        }
+    }
+
+    {
+        /* "\2\5" */
+        const char program[] = "++++[---]++.>+++[+]+++++.";
+        const char output[]  = {0x2, 0x5, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 20;
+        }
+    }
+
+    {
+        /* "W" */
+        const char program[] = ">+++++[--->+<]>.";
+        const char output[]  = "W";
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 21;
+        }
+    }
+
+    {
+        /* "\1\6" */
+        const char program[] = "+[-<+>]<.>>>++[-<+++>]<.";
+        const char output[]  = {0x1, 0x6, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 22;
+        }
+    }
+
+    {
+        /* "\3\1\3" */
+        const char program[] = ">+>>+[<<]+++.>.>>>>++>>>>+++<<<<<<<<[>>>>]<<<<.";
+        const char output[]  = {0x3, 0x1, 0x3, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 23;
+        }
+    }
+
+    {
+        /* [Tape overflow during a scan] */
+        const char program[] =
+            "-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[-"
+            ">+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]"
+            "+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]-[[->+<]+>-]"
+            "+++++++++++++++[[->+<]+>-]+<<<<<<<<[>]";
+
+        int ret = test_interpreter(program, sizeof(program), 4096u,
+            interpret_tape_exceeded, NULL, 0, NULL, 0);
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 24;
+        }
+    }
+
+    {
+        /* "\1\0\2" */
+        const char program[] = ">+>++<-<+.>.>.";
+        const char output[]  = {0x1, 0x0, 0x2, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 25;
+        }
+    }
+
+    {
+        /* "\0\2" [Clamping within a block] */
+        const char program[] = "+<+>.<.";
+        const char output[]  = {0x0, 0x2, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 26;
+        }
+    }
+
+    {
+        /* "\2\2" [Dead loops] */
+        const char program[] = "[.,]++[>+<-][.]>.<+++[-]++.";
+        const char output[]  = {0x2, 0x2, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 27;
+        }
+    }
+
+    {
+        /* "\1\1" [Clamping at a known position] */
+        const char program[] = ">+<<<+>.<.";
+        const char output[]  = {0x1, 0x1, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, NULL, 0, output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 28;
+        }
+    }
+
+    {
+        /* "0" [Resuming after each step of compile-time evaluation] */
+        const char program[] = "++++[>++++[>+++<-]>[>+<-]<<-]>>>.";
+        const char output[]  = "0";
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        for (options.eval_steps = 0; options.eval_steps < 64;
+                options.eval_steps++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, NULL, 0, output, sizeof(output),
+                &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 29;
+            }
+        }
+    }
+
+    {
+        /* "\1\2...\50\50\50\50" [Unrolled loops] */
+        const char program[] =
+            "++++++++++++++++++++++++++++++++++++++++[>+.<-]>>+++[<.>-]";
+        char output[44];
+        size_t i;
+        for (i = 0; i < 40; i++) {
+            output[i] = (char) (i + 1);
+        }
+        output[40] = output[41] = output[42] = 40;
+        output[43] = 0;
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        options.eval_steps = 0;
+
+        int ret = test_interpreter_with_options(program, sizeof(program),
+            (1u << 19), interpret_ok, NULL, 0, output, sizeof(output),
+            &options);
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 30;
+        }
+    }
+
+    {
+        /* "\1\0\2\4\6\10\12\14\16\20" [Vector adds] */
+        const char program[] =
+            ",[->+>++>+++>++++>+++++>++++++>+++++++>++++++++<<<<<<<<.]"
+            ">.>.>.>.>.>.>.>.";
+        const char input[]   = {0x2, 0x0};
+        const char output[]  = {0x1, 0x0, 0x2, 0x4, 0x6, 0x8, 0xA, 0xC, 0xE,
+                                0x10, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, input, sizeof(input), output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 31;
+        }
+    }
+
+    {
+        /* "\7\1\0\0\0" [Clear runs and sweeps] */
+        const char program[] =
+            ">,[>,]<[<]>[-]>[-]>[-]>[-]>[[-]>]+>,.<.<.<"
+            "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<.<<<<.";
+        char input[43];
+        size_t i;
+        for (i = 0; i < 40; i++) {
+            input[i] = (char) (i + 1);
+        }
+        input[40] = 0;
+        input[41] = 7;
+        input[42] = 0;
+        const char output[]  = {0x7, 0x1, 0x0, 0x0, 0x0, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, input, sizeof(input), output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 32;
+        }
+    }
+
+    {
+        /* "\7\1\0\0\0\0" [Each optimization level] */
+        const char program[] =
+            ">,[>,]<[<]>[-]>[-]>[-]>[-]>[[-]>]+>,.<.<.<"
+            "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<.<<<<.>[->++<]>.";
+        char input[43];
+        size_t i;
+        for (i = 0; i < 40; i++) {
+            input[i] = (char) (i + 1);
+        }
+        input[40] = 0;
+        input[41] = 7;
+        input[42] = 0;
+        const char output[]  = {0x7, 0x1, 0x0, 0x0, 0x0, 0x0, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 33;
+            }
+        }
+    }
+
+    {
+        /* "\1\3\3\0\12" [Loops run at most once] */
+        const char program[] =
+            ",[>+>+++<<[-]]>.>.<<,[>>+++>+<<<-]>>.>.<<<,[->>>>+++++<<<<]>>>>.";
+        const char input[]   = {0x5, 0x0, 0x2, 0x0};
+        const char output[]  = {0x1, 0x3, 0x3, 0x0, 0xA, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 34;
+            }
+        }
+    }
+
+    {
+        /* "\3\14\7\0" [Divmod] */
+        const char program[] =
+            ",>++++++++++<[->-[>+>>]>[+[-<+>]>+>>]<<<<<]>>.>.<<.<.";
+        const char input[]   = {0x7B, 0x0};
+        const char output[]  = {0x3, 0xC, 0x7, 0x0, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 35;
+            }
+        }
+    }
+
+    {
+        /* "\5\5" [Outlined loops] */
+        const char program[] =
+            ",[>+<-]>[>+<-]>[>+<-]>.>++[<[>>+<<-]>>[<<+>>-]<-]<.";
+        const char input[]   = {0x5, 0x0};
+        const char output[]  = {0x5, 0x5, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        for (options.outline_min = 0; options.outline_min <= 8;
+                options.outline_min += 4) {
+            for (options.opt_level = 0; options.opt_level <= 2;
+                    options.opt_level++) {
+                int ret = test_interpreter_with_options(program,
+                    sizeof(program), (1u << 19), interpret_ok, input,
+                    sizeof(input), output, sizeof(output), &options);
+                if (ret != 0) {
+                    fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                    return 36;
+                }
+            }
+        }
+    }
+
+    {
+        /* "\6\1" [Loop tests reusing flags] */
+        const char program[] = "+++[>++<-]>.[->+>+<<]>>[-<-<+>>]<<[-]<+-[>]>+.";
+        const char output[]  = {0x6, 0x1, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        options.opt_level = 0;
+        for (options.eval_steps = 0; options.eval_steps <= 16;
+                options.eval_steps++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, NULL, 0, output, sizeof(output),
+                &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 37;
+            }
+        }
+    }
+
+    {
+        /* "\1\1\1\2\4\6\4" [Loops with cells cached in registers] */
+        const char program[] = "++++[>>[-]+<<--[>+<--]>>>+<<<]>.>.>.>"
+            "++++[->+>++>+++>+>+>+>+>+>+>++<<<<<<<<<<-]>.>.>.>>>>>>>.";
+        const char output[]  = {0x1, 0x1, 0x1, 0x2, 0x4, 0x6, 0x4, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        options.eval_steps = 0;
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, NULL, 0, output, sizeof(output),
+                &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 38;
+            }
+        }
+    }
+
+    {
+        /* "ABCA\n" [Constant output runs] */
+        const char program[] =
+            ",[-]+++++++[>+++++++++>+++++++++>+++++++++>+++++++++>+<<<<<-]"
+            ">++>+++>++++>++>+++<<<<.>.>.>.>.";
+        const char input[]   = {0x1, 0x0};
+        const char output[]  = "ABCA\n";
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        options.putstr = test_putstr;
+        unsigned bulk;
+        for (bulk = 0; bulk <= 1; bulk++) {
+            for (options.opt_level = 0; options.opt_level <= 2;
+                    options.opt_level++) {
+                int ret = test_interpreter_with_options(program,
+                    sizeof(program), (1u << 19), interpret_ok, input,
+                    sizeof(input), output, sizeof(output), &options);
+                if (ret != 0) {
+                    fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                    return 39;
+                }
+
+                /* At -O2 the whole run is known, so arrives in one call. */
+                if (options.putstr && options.opt_level == 2 &&
+                        (test_putstr_calls() != 1 ||
+                        test_putchar_calls() != 0)) {
+                    fprintf(stderr, "output took %zu putstr and %zu putchar "
+                        "calls\n", test_putstr_calls(), test_putchar_calls());
+                    return 39;
+                }
+            }
+
+            options.putstr = NULL;
+        }
+    }
+
+    {
+        /* Loops whose jumps straddle the reach of rel8 */
+        const char input[]   = {0x3, 0x0};
+        const char output[]  = {0x3, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        size_t cells;
+        for (cells = 16; cells <= 48; cells++) {
+            char program[256];
+            size_t length = 0, i;
+
+            program[length++] = ',';
+            program[length++] = '[';
+            for (i = 0; i < cells; i++) {
+                program[length++] = '>';
+                program[length++] = '+';
+            }
+            for (i = 0; i < cells; i++) {
+                program[length++] = '<';
+            }
+            program[length++] = '-';
+            program[length++] = ']';
+            for (i = 0; i < cells; i++) {
+                program[length++] = '>';
+            }
+            program[length++] = '.';
+            program[length++] = '\0';
+
+            for (options.opt_level = 0; options.opt_level <= 2;
+                    options.opt_level++) {
+                int ret = test_interpreter_with_options(program, length,
+                    (1u << 19), interpret_ok, input, sizeof(input), output,
+                    sizeof(output), &options);
+                if (ret != 0) {
+                    fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                    return 40;
+                }
+            }
+        }
+    }
+
+    {
+        /* Code larger than the assembler's first mapping, many times over */
+        const char input[]   = {0x3, 0x0};
+        const char output[]  = {0x3, 0x0};
+        const size_t cells   = 1u << 18;
+
+        char * program = malloc(5 * cells + 6);
+        if (!(program)) {
+            fprintf(stderr, "malloc failed\n");
+            return 41;
+        }
+
+        size_t length = 0, i;
+        program[length++] = ',';
+        program[length++] = '[';
+        for (i = 0; i < cells; i++) {
+            program[length++] = '>';
+            program[length++] = '+';
+        }
+        for (i = 0; i < cells; i++) {
+            program[length++] = '<';
+        }
+        program[length++] = '-';
+        program[length++] = ']';
+        for (i = 0; i < cells; i++) {
+            program[length++] = '>';
+        }
+        program[length++] = '.';
+        program[length++] = '\0';
+
+        /* Unoptimized, to emit an instruction for every command */
+        interpret_options_t options;
+        interpret_default_options(&options);
+        options.opt_level = 0;
+
+        int ret = test_interpreter_with_options(program, length, (1u << 20),
+            interpret_ok, input, sizeof(input), output, sizeof(output),
+            &options);
+        free(program);
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 41;
+        }
+    }
+
+    {
+        /* Pointer moves on either side of a disp8 */
+        const char input[]   = {0x5, 0x0};
+        const char output[]  = {0x5, 0x5, 0x0};
+        const size_t moves[] = {1, 127, 128, 200, 4096};
+        char program[3 * 4096 + 16];
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        size_t m;
+        for (m = 0; m < sizeof(moves) / sizeof(moves[0]); m++) {
+            size_t length = 0, i;
+            program[length++] = ',';
+            program[length++] = '[';
+            program[length++] = '-';
+            for (i = 0; i < moves[m]; i++) {
+                program[length++] = '>';
+            }
+            program[length++] = '+';
+            for (i = 0; i < moves[m]; i++) {
+                program[length++] = '<';
+            }
+            program[length++] = ']';
+            for (i = 0; i < moves[m]; i++) {
+                program[length++] = '>';
+            }
+            program[length++] = '.';
+            program[length++] = '<';
+            program[length++] = '+';
+            program[length++] = '+';
+            program[length++] = '+';
+            program[length++] = '+';
+            program[length++] = '+';
+            program[length++] = '.';
+            program[length++] = '\0';
+
+            for (options.opt_level = 0; options.opt_level <= 2;
+                    options.opt_level++) {
+                int ret = test_interpreter_with_options(program, length,
+                    (1u << 19), interpret_ok, input, sizeof(input), output,
+                    sizeof(output), &options);
+                if (ret != 0) {
+                    fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                    return 42;
+                }
+            }
+        }
+    }
+
+    {
+        /* Clamps at the start of the tape, out of line */
+        const char program[] = ",[<<-]<<<+++++.>>,[<]+.<<[<-]+.";
+        const char input[]   = {0x3, 0x4, 0x0};
+        const char output[]  = {0x5, 0x1, 0x1, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 43;
+            }
+        }
+    }
+
+    {
+        /* EOF reads as 0, through the shared input trampoline */
+        const char program[] = ",.,+.,++.";
+        const char input[]   = {0x7, 0x0};
+        const char output[]  = {0x7, 0x1, 0x2, 0x0};
+        int ret = test_interpreter(program, sizeof(program), (1u << 19),
+            interpret_ok, input, sizeof(input), output, sizeof(output));
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 44;
+        }
+    }
+
+    {
+        /* Scans, sweeps and wide vector adds at each CPU tier */
+        char input[101];
+        const char output[] = {0x1, 0x2, 0x8, 0x1, 0x0};
+        char program[768];
+
+        size_t length = 0, i;
+        program[length++] = '>';
+        for (i = 0; i < 100; i++) {
+            input[i] = (char) (i % 7 + 1);
+            program[length++] = ',';
+            program[length++] = '>';
+        }
+        input[100] = 0x0;
+        for (i = 0; i < 100; i++) {
+            program[length++] = '<';
+        }
+        for (i = 0; i < 80; i++) {
+            program[length++] = '+';
+            program[length++] = '>';
+        }
+        for (i = 0; i < 80; i++) {
+            program[length++] = '<';
+        }
+        length += (size_t) sprintf(&program[length], "[>]+.<[<]>.");
+        for (i = 0; i < 69; i++) {
+            program[length++] = '>';
+        }
+        program[length++] = '.';
+        for (i = 0; i < 69; i++) {
+            program[length++] = '<';
+        }
+        length += (size_t) sprintf(&program[length], "[[-]>]<<+.");
+        length++;
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        for (options.cpu_tier = cpu_tier_baseline;
+                options.cpu_tier <= cpu_tier_avx512; options.cpu_tier++) {
+            int ret = test_interpreter_with_options(program, length,
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 45;
+            }
+        }
+    }
+
+    {
+        /* Moves left that provably cannot clamp, next to ones that can */
+        const char program[] =
+            ">>>,[-<<+>>]<<.,[<+>-]<[>+<<->-]>.>>>>>,[-<]<<+.";
+        const char input[]   = {0x3, 0x2, 0x2, 0x0};
+        const char output[]  = {0x3, 0x0, 0x1, 0x0};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        for (options.opt_level = 0; options.opt_level <= 2;
+                options.opt_level++) {
+            int ret = test_interpreter_with_options(program, sizeof(program),
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                return 46;
+            }
+        }
+    }
+
+    {
+        /* Each cell width wraps at its own size, and outputs its low byte */
+        const char program[] =
+            "++++++++[>++++++++++++++++++++++++++++++++<-]>[>+>+<<-]>"
+            "[>>+<<[-]]>>.<[->>++++++++[>++++++++++++++++++++++++++++++++<-]"
+            "<<]>>>[>+<[-]]>.--"
+            "------------------------------------------------------------------"
+            "--------------------------------------------------------------.>,"
+            "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
+            "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
+            "[>+<[-]]>.";
+        const char input[] = {(char) 0x80, 0x0};
+        const char outputs[3][5] = {
+            {0x0, 0x0, 0x7E, 0x0, 0x0},
+            {0x1, 0x0, 0x7E, 0x1, 0x0},
+            {0x1, 0x1, 0x7F, 0x1, 0x0},
+        };
+        const unsigned cell_sizes[3] = {1, 2, 4};
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        size_t i;
+        for (i = 0; i < 3; i++) {
+            options.cell_size = cell_sizes[i];
+            for (options.opt_level = 0; options.opt_level <= 2;
+                    options.opt_level++) {
+                int ret = test_interpreter_with_options(program,
+                    sizeof(program), (1u << 19), interpret_ok, input,
+                    sizeof(input), outputs[i], sizeof(outputs[i]), &options);
+                if (ret != 0) {
+                    fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                    return 47;
+                }
+            }
+        }
+
+        options.cell_size = 3;
+        int ret = test_interpreter_with_options(program, sizeof(program),
+            (1u << 19), interpret_cell_size, input, sizeof(input), NULL, 0,
+            &options);
+        if (ret != 0) {
+            fprintf(stderr, "test_interpreter failed with %d\n", ret);
+            return 47;
+        }
+    }
+
+    {
+        /*
+         * Deeply nested loops compile in work linear in their size, with
+         * loops outlined and, without outlining, with their cells cached.
+         * The loops are skipped, as some would run for long otherwise.
+         */
+        const char input[]   = {0x0};
+        const char output[]  = {0x0, 0x0};
+        const size_t depth   = 40000;
+        const char * opens[2]   = {"[-", "[>+<"};
+        const char * closes[2]  = {"]", "-]"};
+
+        char * program = malloc(6 * depth + 3);
+        if (!(program)) {
+            fprintf(stderr, "malloc failed\n");
+            return 48;
+        }
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+
+        size_t body;
+        for (body = 0; body < 2; body++) {
+            size_t length = 0, i;
+            program[length++] = ',';
+            for (i = 0; i < depth; i++) {
+                length += (size_t) sprintf(&program[length], "%s",
+                    opens[body]);
+            }
+            for (i = 0; i < depth; i++) {
+                length += (size_t) sprintf(&program[length], "%s",
+                    closes[body]);
+            }
+            program[length++] = '.';
+            program[length++] = '\0';
+
+            if (body == 1) {
+                options.opt_level   = 1;
+                options.outline_min = 0;
+            }
+
+            int ret = test_interpreter_with_options(program, length,
+                (1u << 19), interpret_ok, input, sizeof(input), output,
+                sizeof(output), &options);
+            const size_t steps = interpret_analysis_steps();
+            if (ret != 0) {
+                fprintf(stderr, "test_interpreter failed with %d\n", ret);
+                free(program);
+                return 48;
+            } else if (steps > 4u * length) {
+                fprintf(stderr, "compiling examined %zu instructions\n",
+                    steps);
+                free(program);
+                return 48;
+            }
+        }
+
+        free(program);
+    }
+
+    {
+        /*
+         * Touching a cell past the end of the tape faults, even where the
+         * cell's value is known, and before any output that follows it
+         */
+        const char input[]          = {'x', 0x0};
+        const size_t cells          = 4096;
+        const char * heads[3]       = {",[-]+++++.", "", ""};
+        const size_t rights[3]      = {cells, cells + 904, cells + 904};
+        const char * bodies[3]      = {"+", ".", "[+]"};
+        const size_t lefts[3]       = {cells, 0, 0};
+        const char * tails[3]       = {".", "", ""};
+        const char outputs[3][2]    = {{0x5, 0x0}, {0x0}, {0x0}};
+        const size_t output_sizes[3] = {2, 1, 1};
+
+        char * program = malloc(4 * cells);
+        if (!(program)) {
+            fprintf(stderr, "malloc failed\n");
+            return 49;
+        }
+
+        interpret_options_t options;
+        interpret_default_options(&options);
+        const size_t eval_steps = options.eval_steps;
+
+        size_t c;
+        for (c = 0; c < 3; c++) {
+            size_t length = 0, i;
+            length += (size_t) sprintf(&program[length], "%s", heads[c]);
+            for (i = 0; i < rights[c]; i++) {
+                program[length++] = '>';
+            }
+            length += (size_t) sprintf(&program[length], "%s", bodies[c]);
+            for (i = 0; i < lefts[c]; i++) {
+                program[length++] = '<';
+            }
+            length += (size_t) sprintf(&program[length], "%s", tails[c]);
+            program[length++] = '\0';
+
+            /* Both compiled, and run at compile time as far as possible */
+            size_t e;
+            for (e = 0; e < 2; e++) {
+                options.eval_steps = e ? eval_steps : 0;
+                for (options.opt_level = 0; options.opt_level <= 2;
+                        options.opt_level++) {
+                    int ret = test_interpreter_with_options(program, length,
+                        cells, interpret_tape_exceeded, input, sizeof(input),
+                        outputs[c], output_sizes[c], &options);
+                    if (ret != 0) {
+                        fprintf(stderr, "test_interpreter failed with %d\n",
+                            ret);
+                        free(program);
+                        return 49;
+                    }
+                }
+            }
+        }
+
+        free(program);
+    }
+
     return 0;
 }
@@ -0,0 +1,1676 @@
+/**
+ * bf - A JIT'ing Interpreter for a Turing Tarpit
+ * (c) 2012 - Chris Kennelly (chris@ckennelly.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "common.h"
+#include "cpu.h"
+#include "interpreter.h"
+#include "ir.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Replace clearing loops with direct stores.
+ *
+ * A loop whose body is a single modification by an odd amount ([-], [+],
+ * [---], ...) terminates for every starting value, leaving the cell zero.
+ * When the loop is immediately followed by another modification, the two
+ * fold into a store of that constant.
+ *
+ * The instructions are compacted in place and the new count is returned.
+ */
+static size_t condense_clears(instruction_t * instructions, size_t op_count) {
+    size_t in, out = 0;
+    for (in = 0; in < op_count; in++) {
+        if (in + 2 < op_count &&
+                instructions[in    ].op == op_if &&
+                instructions[in + 1].op == op_modify &&
+                (instructions[in + 1].val & 1) != 0 &&
+                instructions[in + 2].op == op_endif) {
+            instructions[out].op  = op_clear;
+            instructions[out].val = 0;
+            in += 2;
+
+            if (in + 1 < op_count && instructions[in + 1].op == op_modify) {
+                instructions[out].op  = op_set;
+                instructions[out].val = instructions[in + 1].val;
+                in++;
+            }
+        } else {
+            instructions[out] = instructions[in];
+        }
+
+        out++;
+    }
+
+    return out;
+}
+
+/**
+ * Replace loops that only move the pointer ([>], [<<], ...) with scans, and
+ * the sweep [[-]>], which clears cells up to the next zero, with op_sweep.
+ *
+ * The instructions are compacted in place and the new count is returned.
+ */
+static size_t condense_scans(instruction_t * instructions, size_t op_count) {
+    size_t in, out = 0;
+    for (in = 0; in < op_count; in++) {
+        if (in + 2 < op_count &&
+                instructions[in    ].op == op_if &&
+                (instructions[in + 1].op == op_right ||
+                 instructions[in + 1].op == op_left) &&
+                instructions[in + 2].op == op_endif) {
+            instructions[out].op  = op_scan;
+            instructions[out].val = instructions[in + 1].op == op_right ?
+                instructions[in + 1].val : -instructions[in + 1].val;
+            in += 2;
+        } else if (in + 3 < op_count &&
+                instructions[in    ].op == op_if &&
+                instructions[in + 1].op == op_clear &&
+                instructions[in + 2].op == op_right &&
+                instructions[in + 2].val == 1 &&
+                instructions[in + 3].op == op_endif) {
+            instructions[out].op  = op_sweep;
+            instructions[out].val = 1;
+            in += 3;
+        } else {
+            instructions[out] = instructions[in];
+        }
+
+        out++;
+    }
+
+    return out;
+}
+
+/**
+ * The usual divmod loop, which takes the cells
+ *
+ *      n d 0 0 0 0  to  0 d-n%d n%d n/d 0 0
+ *
+ * one step of n at a time.
+ */
+static const char divmod_idiom[] = "[->-[>+>>]>[+[-<+>]>+>>]<<<<<]";
+
+static int matches_idiom(const instruction_t * instructions, size_t op_count,
+        const program_t * idiom) {
+    if (op_count < idiom->count) {
+        return 0;
+    }
+
+    size_t i;
+    for (i = 0; i < idiom->count; i++) {
+        if (instructions[i].op  != idiom->instructions[i].op ||
+                instructions[i].val != idiom->instructions[i].val) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Precede each divmod loop with an op_divmod, which does all of its work at
+ * once whenever its cells are laid out as the loop expects.  The loop itself
+ * is kept for when they are not.
+ *
+ * Returns a newly allocated instruction list, or NULL on failure.
+ */
+static instruction_t * condense_divmods(const instruction_t * instructions,
+        size_t op_count, const program_t * idiom, size_t * new_op_count) {
+    size_t i, matches = 0;
+    for (i = 0; i < op_count; i++) {
+        matches += (size_t) matches_idiom(&instructions[i], op_count - i,
+            idiom);
+    }
+
+    instruction_t * ret =
+        malloc(sizeof(instruction_t) * (op_count + matches + 1u));
+    if (!(ret)) {
+        return NULL;
+    }
+
+    size_t out = 0;
+    for (i = 0; i < op_count; i++) {
+        if (matches_idiom(&instructions[i], op_count - i, idiom)) {
+            ret[out].op     = op_divmod;
+            ret[out].val    = 0;
+            ret[out].offset = 0;
+            out++;
+        }
+
+        ret[out++] = instructions[i];
+    }
+
+    *new_op_count = out;
+    return ret;
+}
+
+#define MAX_FACTS 64
+
+typedef enum cell_state {
+    cell_unknown,
+    cell_known,
+    cell_nonzero
+} cell_state_t;
+
+typedef struct fact {
+    ptrdiff_t    offset;
+    cell_state_t state;
+    uint8_t      value;
+} fact_t;
+
+/**
+ * What propagate_constants knows about the tape.  Facts are keyed by their
+ * offset from the pointer.  When all_zero is set, every cell without a fact
+ * is zero; otherwise it is unknown.  The pointer is at least position cells
+ * from the start of the tape, or exactly that far when exact is set.  The
+ * tape holds tape_size cells.
+ */
+typedef struct facts {
+    int          all_zero;
+    int          exact;
+    ptrdiff_t    position;
+    size_t       tape_size;
+    size_t       count;
+    fact_t       fact[MAX_FACTS];
+} facts_t;
+
+/**
+ * Returns nonzero if the cell at offset lies past the end of the tape, so
+ * touching it faults.  position only bounds the pointer from below, so a cell
+ * not found to lie past the end may still do so.
+ */
+static int past_tape(const facts_t * facts, ptrdiff_t offset) {
+    const ptrdiff_t at = facts->position + offset;
+    return at >= 0 && (size_t) at >= facts->tape_size;
+}
+
+/**
+ * Returns what we know of the cell at offset, storing its value to value if
+ * it is known.  Nothing is known of a cell past the end of the tape, so the
+ * access that faults on it is kept.
+ */
+static cell_state_t get_fact(const facts_t * facts, ptrdiff_t offset,
+        uint8_t * value) {
+    *value = 0;
+    if (past_tape(facts, offset)) {
+        return cell_unknown;
+    }
+
+    size_t i;
+    for (i = 0; i < facts->count; i++) {
+        if (facts->fact[i].offset == offset) {
+            *value = facts->fact[i].value;
+            return facts->fact[i].state;
+        }
+    }
+
+    return facts->all_zero ? cell_known : cell_unknown;
+}
+
+/**
+ * Forgets everything about the cells near the pointer, as after it moves an
+ * unknown distance.
+ */
+static void forget_facts(facts_t * facts) {
+    size_t i;
+    for (i = 0; i < facts->count; i++) {
+        if (facts->fact[i].state != cell_known || facts->fact[i].value != 0) {
+            facts->all_zero = 0;
+        }
+    }
+
+    facts->count = 0;
+}
+
+static void set_fact(facts_t * facts, ptrdiff_t offset, cell_state_t state,
+        uint8_t value) {
+    size_t i;
+    for (i = 0; i < facts->count; i++) {
+        if (facts->fact[i].offset == offset) {
+            break;
+        }
+    }
+
+    if (i == MAX_FACTS) {
+        /* Out of room.  Giving up on what we know is always safe. */
+        forget_facts(facts);
+        facts->all_zero = 0;
+        i = 0;
+    }
+
+    facts->fact[i].offset   = offset;
+    facts->fact[i].state    = state;
+    facts->fact[i].value    = value;
+    if (i == facts->count) {
+        facts->count++;
+    }
+}
+
+/**
+ * Moves the pointer by delta, which must not clamp.
+ */
+static void shift_facts(facts_t * facts, ptrdiff_t delta) {
+    size_t i;
+    for (i = 0; i < facts->count; i++) {
+        facts->fact[i].offset -= delta;
+    }
+
+    facts->position += delta;
+}
+
+/**
+ * Applies an instruction to what we know, possibly rewriting it.  Returns
+ * zero if the instruction can be dropped.  For op_if, that means the whole
+ * loop can be dropped.
+ */
+static int propagate(facts_t * facts, instruction_t * inst) {
+    uint8_t value;
+    const cell_state_t state = get_fact(facts, 0, &value);
+    const int zero = state == cell_known && value == 0;
+
+    switch (inst->op) {
+        case op_modify:
+            if (state == cell_known) {
+                inst->op    = op_set;
+                inst->val   = (value + inst->val) & 0xFF;
+                set_fact(facts, 0, cell_known, (uint8_t) inst->val);
+            } else {
+                set_fact(facts, 0, cell_unknown, 0);
+            }
+            break;
+        case op_clear:
+        case op_set:
+            if (state == cell_known && value == (inst->val & 0xFF)) {
+                return 0;
+            }
+
+            set_fact(facts, 0, cell_known, (uint8_t) (inst->val & 0xFF));
+            break;
+        case op_get:
+            set_fact(facts, 0, cell_unknown, 0);
+            break;
+        case op_put:
+            if (state == cell_known) {
+                inst->op    = op_print;
+                inst->val   = value;
+            }
+            break;
+        case op_print:
+            break;
+        case op_right:
+            shift_facts(facts, inst->val);
+            break;
+        case op_left:
+            if (facts->position >= inst->val) {
+                shift_facts(facts, -inst->val);
+            } else if (facts->exact) {
+                /* We know exactly where we clamp. */
+                shift_facts(facts, -facts->position);
+            } else {
+                forget_facts(facts);
+                facts->position = 0;
+            }
+            break;
+        case op_scan:
+            if (zero) {
+                return 0;
+            }
+
+            forget_facts(facts);
+            facts->exact = 0;
+            if (inst->val < 0) {
+                facts->position = 0;
+            }
+            set_fact(facts, 0, cell_known, 0);
+            break;
+        case op_sweep:
+            if (zero) {
+                return 0;
+            }
+
+            forget_facts(facts);
+            facts->exact = 0;
+            set_fact(facts, 0, cell_known, 0);
+            break;
+        case op_divmod:
+            if (zero) {
+                return 0;
+            }
+
+            {
+            /* It may write n, d and the remainder and quotient after them. */
+            ptrdiff_t offset;
+            for (offset = 0; offset < 4; offset++) {
+                set_fact(facts, offset, cell_unknown, 0);
+            }
+            }
+            break;
+        case op_if:
+            if (zero) {
+                return 0;
+            }
+
+            inst->val = state != cell_unknown;
+
+            /* The body may run any number of times, touching anything. */
+            forget_facts(facts);
+            facts->all_zero = 0;
+            facts->exact    = 0;
+            facts->position = 0;
+            set_fact(facts, 0, cell_nonzero, 0);
+            break;
+        case op_endif:
+            inst->val = zero;
+
+            forget_facts(facts);
+            facts->all_zero = 0;
+            facts->exact    = 0;
+            facts->position = 0;
+            set_fact(facts, 0, cell_known, 0);
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * A growable instruction list.  Once an allocation fails, further pushes are
+ * ignored and failed is set.
+ */
+typedef struct instruction_list {
+    instruction_t * instructions;
+    size_t          count;
+    size_t          capacity;
+    int             failed;
+} instruction_list_t;
+
+static void push_instruction(instruction_list_t * list,
+        const instruction_t * inst) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2u * list->capacity : 64u;
+        instruction_t * instructions =
+            realloc(list->instructions, sizeof(instruction_t) * capacity);
+        if (!(instructions)) {
+            list->failed = 1;
+            return;
+        }
+
+        list->instructions  = instructions;
+        list->capacity      = capacity;
+    }
+
+    list->instructions[list->count++] = *inst;
+}
+
+/**
+ * Propagates an instruction, keeping it if it is still needed.
+ */
+static void propagate_push(facts_t * facts, instruction_list_t * list,
+        instruction_t inst) {
+    if (propagate(facts, &inst)) {
+        push_instruction(list, &inst);
+    }
+}
+
+#define UNROLL_BUDGET 64
+
+/**
+ * Unrolls the loop opening at instructions[i], whose cell is known to hold
+ * control, if its trip count is fixed.
+ *
+ * That is the case when the body is straight-line code with no net movement
+ * that only adds a constant d to the control cell:  the loop runs for the
+ * smallest n with control + n * d = 0 (mod 256).  A body that only adds to
+ * cells becomes a single copy adding n times as much.  Otherwise, short
+ * loops are fully unrolled.  Longer ones run the remainder of n modulo an
+ * unrolling factor first, then loop over that many copies of the body, so
+ * that the exit test runs once per copy of the body rather than once per
+ * iteration.
+ *
+ * Returns the index of the matching op_endif if the loop was unrolled, or i
+ * otherwise.
+ */
+static size_t unroll_loop(const instruction_t * instructions,
+        size_t op_count, size_t i, uint8_t control, facts_t * facts,
+        instruction_list_t * list) {
+    ptrdiff_t pos = 0, min_pos = 0;
+    unsigned  d = 0;
+    int       additive = 1;
+    size_t    j;
+    for (j = i + 1; j < op_count; j++) {
+        const instruction_t * inst = &instructions[j];
+        if (inst->op == op_right) {
+            pos += inst->val;
+        } else if (inst->op == op_left) {
+            pos -= inst->val;
+            if (pos < min_pos) {
+                min_pos = pos;
+            }
+        } else if (inst->op == op_modify) {
+            if (pos == 0) {
+                d += (unsigned) inst->val;
+            }
+        } else if (inst->op == op_put || inst->op == op_get ||
+                inst->op == op_clear || inst->op == op_set) {
+            if (pos == 0 && inst->op != op_put) {
+                return i;
+            }
+            additive = 0;
+        } else {
+            break;
+        }
+    }
+
+    /* The body must be balanced and never clamp. */
+    if (j == op_count || instructions[j].op != op_endif || pos != 0 ||
+            facts->position < -min_pos) {
+        return i;
+    }
+
+    size_t n;
+    for (n = 1; n <= 256; n++) {
+        if (((control + n * d) & 0xFF) == 0) {
+            break;
+        }
+    }
+    if (n > 256) {
+        /* The loop never terminates. */
+        return i;
+    }
+
+    const size_t len = j - i - 1;
+    size_t k, copy;
+    if (additive) {
+        for (k = i + 1; k < j; k++) {
+            instruction_t inst = instructions[k];
+            if (inst.op == op_modify) {
+                inst.val = (inst.val * (ptrdiff_t) n) & 0xFF;
+            }
+            propagate_push(facts, list, inst);
+        }
+    } else if (n * len <= UNROLL_BUDGET) {
+        for (copy = 0; copy < n; copy++) {
+            for (k = i + 1; k < j; k++) {
+                propagate_push(facts, list, instructions[k]);
+            }
+        }
+    } else {
+        const size_t factor = UNROLL_BUDGET / len;
+        if (factor < 2) {
+            return i;
+        }
+
+        for (copy = 0; copy < n % factor; copy++) {
+            for (k = i + 1; k < j; k++) {
+                propagate_push(facts, list, instructions[k]);
+            }
+        }
+
+        propagate_push(facts, list, instructions[i]);
+        for (copy = 0; copy < factor; copy++) {
+            for (k = i + 1; k < j; k++) {
+                propagate_push(facts, list, instructions[k]);
+            }
+        }
+        propagate_push(facts, list, instructions[j]);
+    }
+
+    return j;
+}
+
+/**
+ * Replace operations on cells of known value with constant stores and
+ * outputs, and remove loops that can never be entered.
+ *
+ * The tape starts zeroed and a loop always leaves its cell zero, so the
+ * leading "comment" loop of a program, a loop directly following another on
+ * the same cell, and clears of cells that are already zero all disappear.
+ * Loops whose cell is known to be nonzero are marked so that they skip their
+ * initial test, and loops whose trip count is known are unrolled.  Since '<'
+ * clamps at the start of the tape, what we know is kept across it only when
+ * the pointer is known to be far enough along.
+ *
+ * Returns a newly allocated instruction list, or NULL on failure.
+ */
+static instruction_t * propagate_constants(const instruction_t * instructions,
+        size_t op_count, size_t tape_size, size_t * new_op_count) {
+    facts_t facts;
+    facts.all_zero  = 1;
+    facts.exact     = 1;
+    facts.position  = 0;
+    facts.tape_size = tape_size;
+    facts.count     = 0;
+
+    instruction_list_t list;
+    memset(&list, 0, sizeof(list));
+
+    size_t in;
+    for (in = 0; in < op_count; in++) {
+        instruction_t inst = instructions[in];
+        if (inst.op == op_if) {
+            uint8_t value;
+            if (get_fact(&facts, 0, &value) == cell_known && value != 0) {
+                size_t end = unroll_loop(instructions, op_count, in, value,
+                    &facts, &list);
+                if (end != in) {
+                    in = end;
+                    continue;
+                }
+            }
+        }
+
+        if (propagate(&facts, &inst)) {
+            push_instruction(&list, &inst);
+        } else if (inst.op == op_if) {
+            /* Skip to the matching op_endif. */
+            size_t depth = 1;
+            while (depth > 0) {
+                in++;
+                assert(in < op_count);
+                if (instructions[in].op == op_if) {
+                    depth++;
+                } else if (instructions[in].op == op_endif) {
+                    depth--;
+                }
+            }
+        }
+    }
+
+    /* Make sure we hand back something, even for an empty program. */
+    if (!(list.instructions) && !(list.failed)) {
+        list.instructions = malloc(sizeof(instruction_t));
+    }
+
+    if (list.failed || !(list.instructions)) {
+        free(list.instructions);
+        return NULL;
+    }
+
+    *new_op_count = list.count;
+    return list.instructions;
+}
+
+/**
+ * Computes the multiplicative inverse of an odd value modulo a cell, whose
+ * bits are mask.
+ */
+static uint32_t inverse_mod(uint32_t v, uint32_t mask) {
+    assert((v & 1) != 0);
+
+    /* Newton's method:  v is its own inverse modulo 8 and each step doubles
+     * the number of correct low bits. */
+    uint32_t x = v;
+    unsigned bits;
+    for (bits = 3; bits < 32 && (mask >> bits) != 0; bits *= 2) {
+        x = (x * (2u - v * x)) & mask;
+    }
+    return x;
+}
+
+/**
+ * Replace balanced loops with closed-form multiplications.
+ *
+ * A loop whose body only modifies cells and moves the pointer, with no net
+ * movement and an odd change d to the control cell, runs
+ * n = c * inverse(-d) (mod 2^8, 2^16 or 2^32, as wide as a cell, whose bits
+ * are mask) times for a starting value c.  Every other cell
+ * touched by the body gains k * n, that is c * (k * inverse(-d)).  The loop
+ * becomes:
+ *
+ *      [ guard mul... clear ] fallback
+ *
+ * The surrounding op_if/op_endif keep us from touching any other cells when
+ * the control is already zero, just as the original loop would.  When the
+ * body reaches to the left of the control cell, '<' may clamp at the start of
+ * the tape, so the guard diverts to an unmodified copy of the loop there.
+ *
+ * Returns a newly allocated instruction list, or NULL on failure.
+ */
+static instruction_t * condense_multiplies(const instruction_t * instructions,
+        size_t op_count, size_t * new_op_count, uint32_t mask) {
+    /* The fallback copy can at most double a loop, plus a few instructions
+     * for the guard and clear. */
+    instruction_t * ret = malloc(sizeof(instruction_t) * (3u * op_count + 1u));
+    if (!(ret)) {
+        return NULL;
+    }
+
+    size_t i, j, k, out = 0;
+    for (i = 0; i < op_count; i++) {
+        if (instructions[i].op != op_if) {
+            ret[out++] = instructions[i];
+            continue;
+        }
+
+        ptrdiff_t pos = 0, min_pos = 0, max_pos = 0, control = 0;
+        for (j = i + 1; j < op_count; j++) {
+            const instruction_t * inst = &instructions[j];
+            if (inst->op == op_modify) {
+                if (pos == 0) {
+                    control += inst->val;
+                }
+            } else if (inst->op == op_right) {
+                pos += inst->val;
+                if (pos > max_pos) {
+                    max_pos = pos;
+                }
+            } else if (inst->op == op_left) {
+                pos -= inst->val;
+                if (pos < min_pos) {
+                    min_pos = pos;
+                }
+            } else {
+                break;
+            }
+        }
+
+        if (j == op_count || instructions[j].op != op_endif || pos != 0 ||
+                (control & 1) == 0 || max_pos > INT32_MAX ||
+                min_pos < -INT32_MAX) {
+            ret[out++] = instructions[i];
+            continue;
+        }
+
+        const uint32_t scale = inverse_mod((uint32_t) -control & mask, mask);
+
+        ret[out++] = instructions[i];
+        if (min_pos < 0) {
+            ret[out].op     = op_guard;
+            ret[out].val    = -min_pos;
+            ret[out].offset = 0;
+            out++;
+        }
+
+        /* Accumulate the change to each offset. */
+        const size_t first = out;
+        for (k = i + 1, pos = 0; k < j; k++) {
+            const instruction_t * inst = &instructions[k];
+            if (inst->op == op_right) {
+                pos += inst->val;
+            } else if (inst->op == op_left) {
+                pos -= inst->val;
+            } else if (pos != 0) {
+                size_t term;
+                for (term = first; term < out; term++) {
+                    if (ret[term].offset == pos) {
+                        break;
+                    }
+                }
+
+                if (term == out) {
+                    ret[out].op     = op_mul;
+                    ret[out].val    = 0;
+                    ret[out].offset = pos;
+                    out++;
+                }
+
+                ret[term].val += inst->val;
+            }
+        }
+
+        /* Scale, dropping any terms that cancelled out. */
+        size_t term, kept = first;
+        for (term = first; term < out; term++) {
+            uint32_t factor = ((uint32_t) ret[term].val * scale) & mask;
+            if (factor != 0) {
+                ret[kept]       = ret[term];
+                ret[kept].val   = (ptrdiff_t) factor;
+                kept++;
+            }
+        }
+        out = kept;
+
+        ret[out].op     = op_clear;
+        ret[out].val    = 0;
+        ret[out].offset = 0;
+        out++;
+
+        /* Having cleared the control, the loop always exits. */
+        ret[out]        = instructions[j];
+        ret[out].val    = 1;
+        out++;
+
+        if (min_pos < 0) {
+            ret[out]    = instructions[i];
+            ret[out].op = op_fallback;
+            out++;
+            for (k = i + 1; k <= j; k++) {
+                ret[out++] = instructions[k];
+            }
+        }
+
+        i = j;
+    }
+
+    assert(out <= 3u * op_count + 1u);
+    *new_op_count = out;
+    return ret;
+}
+
+/**
+ * Returns nonzero for instructions that may appear in the straight-line blocks
+ * rewritten by defer_moves.
+ */
+static int is_straight_line(op_t op) {
+    switch (op) {
+        case op_modify:
+        case op_right:
+        case op_left:
+        case op_clear:
+        case op_set:
+        case op_put:
+        case op_get:
+        case op_print:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Rewrites a straight-line block of n instructions with its pointer movement
+ * deferred, storing the result to out unless it is NULL.  Returns the number
+ * of instructions produced.
+ *
+ * Each cell access is addressed by its offset from the pointer at the start
+ * of the block, and the pointer is moved once at the end.  This is only
+ * faithful when no '<' in the block clamps, so a block that reaches to the
+ * left of its starting cell is guarded and followed by an unmodified copy:
+ *
+ *      guard deferred... cold original... join
+ */
+static size_t defer_block(const instruction_t * in, size_t n,
+        instruction_t * out) {
+    size_t i, count = 0;
+    ptrdiff_t pos = 0, min_pos = 0, max_pos = 0;
+    int moves = 0;
+    for (i = 0; i < n; i++) {
+        if (in[i].op == op_right) {
+            pos += in[i].val;
+            moves = 1;
+        } else if (in[i].op == op_left) {
+            pos -= in[i].val;
+            moves = 1;
+        }
+
+        if (pos < min_pos) {
+            min_pos = pos;
+        }
+        if (pos > max_pos) {
+            max_pos = pos;
+        }
+    }
+
+    const int deferred = moves && max_pos <= INT32_MAX &&
+        min_pos >= -INT32_MAX;
+    if (deferred) {
+        if (min_pos < 0) {
+            if (out) {
+                out[count].op       = op_guard;
+                out[count].val      = -min_pos;
+                out[count].offset   = 0;
+            }
+            count++;
+        }
+
+        for (i = 0, pos = 0; i < n; i++) {
+            if (in[i].op == op_right) {
+                pos += in[i].val;
+            } else if (in[i].op == op_left) {
+                pos -= in[i].val;
+            } else {
+                if (out) {
+                    out[count]          = in[i];
+                    out[count].offset   = pos;
+                }
+                count++;
+            }
+        }
+
+        if (pos != 0) {
+            if (out) {
+                out[count].op       = op_right;
+                out[count].val      = pos;
+                out[count].offset   = 0;
+            }
+            count++;
+        }
+
+        if (min_pos >= 0) {
+            return count;
+        }
+
+        if (out) {
+            out[count].op       = op_cold;
+            out[count].offset   = 0;
+        }
+        count++;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (out) {
+            out[count]          = in[i];
+            out[count].offset   = 0;
+        }
+        count++;
+    }
+
+    if (deferred) {
+        if (out) {
+            out[count].op       = op_join;
+            out[count].offset   = 0;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Defer pointer movement within each straight-line block to its end.  See
+ * defer_block.
+ *
+ * Returns a newly allocated instruction list, or NULL on failure.
+ */
+static instruction_t * defer_moves(const instruction_t * instructions,
+        size_t op_count, size_t * new_op_count) {
+    size_t i, j, out = 0;
+    for (i = 0; i < op_count; i = j) {
+        if (!(is_straight_line(instructions[i].op))) {
+            j = i + 1;
+            out++;
+            continue;
+        }
+
+        for (j = i; j < op_count && is_straight_line(instructions[j].op); j++) {
+            /* Find the end of the block. */
+        }
+
+        out += defer_block(&instructions[i], j - i, NULL);
+    }
+
+    instruction_t * ret = malloc(sizeof(instruction_t) * (out + 1u));
+    if (!(ret)) {
+        return NULL;
+    }
+
+    *new_op_count = out;
+    for (i = 0, out = 0; i < op_count; i = j) {
+        if (!(is_straight_line(instructions[i].op))) {
+            j = i + 1;
+            ret[out++] = instructions[i];
+            continue;
+        }
+
+        for (j = i; j < op_count && is_straight_line(instructions[j].op); j++) {
+            /* Find the end of the block. */
+        }
+
+        out += defer_block(&instructions[i], j - i, &ret[out]);
+    }
+
+    assert(out == *new_op_count);
+    return ret;
+}
+
+#if defined(HOST_ARCH_X64)
+/**
+ * Returns nonzero for instructions that vectorize_runs may gather into vector
+ * stores.
+ */
+static int is_store(op_t op) {
+    return op == op_clear || op == op_set;
+}
+
+/**
+ * Rewrites a run of n modifications, or of n stores, storing the result to
+ * out unless it is NULL.  Returns the number of instructions produced.
+ *
+ * The deltas (or the last value stored) are gathered per cell and covered
+ * greedily by windows of max_width (64 with AVX-512BW, 32 with AVX2, or 16),
+ * or of half, a quarter and so on down to 4 cells, each of which is
+ * handled by a single vector instruction.  An add window needs at least
+ * MIN_LANES changed cells, and starts at a changed cell and ends by the last
+ * one, so it only touches cells within the span the run already touches.  A
+ * store window must be stored to in full.  Whatever is left over remains a
+ * scalar op_modify, op_clear or op_set.
+ */
+#define MIN_LANES 4
+static size_t vectorize_run(const instruction_t * in, size_t n,
+        ptrdiff_t min_offset, uint8_t * values, uint8_t * touched,
+        ptrdiff_t max_width, instruction_t * out) {
+    const int stores = is_store(in[0].op);
+
+    size_t i, count = 0;
+    ptrdiff_t span = 0;
+    for (i = 0; i < n; i++) {
+        const ptrdiff_t at = in[i].offset - min_offset;
+        if (stores) {
+            values[at] = (uint8_t) in[i].val;
+        } else {
+            values[at] = (uint8_t) (values[at] + in[i].val);
+        }
+        touched[at] = 1;
+        if (at >= span) {
+            span = at + 1;
+        }
+    }
+
+    if (!(stores)) {
+        for (i = 0; i < (size_t) span; i++) {
+            touched[i] = values[i] != 0;
+        }
+    }
+
+    while (span > 0 && !(touched[span - 1])) {
+        span--;
+    }
+
+    ptrdiff_t at = 0;
+    while (at < span) {
+        if (!(touched[at])) {
+            at++;
+            continue;
+        }
+
+        ptrdiff_t width;
+        for (width = max_width; width >= MIN_LANES; width /= 2) {
+            if (at + width > span) {
+                continue;
+            }
+
+            ptrdiff_t j;
+            size_t lanes = 0;
+            for (j = 0; j < width; j++) {
+                lanes += touched[at + j];
+            }
+            if (stores ? lanes == (size_t) width : lanes >= MIN_LANES) {
+                break;
+            }
+        }
+
+        if (width < MIN_LANES) {
+            /* Too sparse; leave this cell to a scalar instruction. */
+            if (out) {
+                out[count].op       = !(stores) ? op_modify :
+                                      values[at] ? op_set : op_clear;
+                out[count].val      = values[at];
+                out[count].offset   = min_offset + at;
+            }
+            count++;
+            at++;
+            continue;
+        }
+
+        if (out) {
+            out[count].op       = stores ? op_vstore : op_vadd;
+            out[count].val      = width;
+            out[count].offset   = min_offset + at;
+        }
+        count++;
+
+        ptrdiff_t j;
+        for (j = 0; j < width; j++) {
+            if (touched[at + j]) {
+                if (out) {
+                    out[count].op       = op_lane;
+                    out[count].val      = values[at + j];
+                    out[count].offset   = min_offset + at + j;
+                }
+                count++;
+            }
+        }
+
+        at += width;
+    }
+
+    memset(values,  0, (size_t) span);
+    memset(touched, 0, (size_t) span);
+    return count;
+}
+
+/**
+ * Replace runs of modifications to nearby cells, as left behind by
+ * defer_moves for code such as +>++>+++>++++, with vector adds, and runs of
+ * stores, such as [-]>[-]>[-]>[-], with vector stores.  See vectorize_run.
+ *
+ * Returns a newly allocated instruction list, or NULL on failure.
+ */
+static instruction_t * vectorize_runs(const instruction_t * instructions,
+        size_t op_count, size_t * new_op_count, ptrdiff_t max_width) {
+    /* Only runs spanning fewer than max_span cells per instruction are
+     * considered, which bounds the scratch space needed. */
+    const ptrdiff_t max_span = 8;
+    uint8_t * values = calloc(2u * (op_count + 1u), (size_t) max_span);
+    if (!(values)) {
+        return NULL;
+    }
+    uint8_t * touched = values + (op_count + 1u) * (size_t) max_span;
+
+    size_t pass, i, j, out = 0;
+    instruction_t * ret = NULL;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0, out = 0; i < op_count; i = j) {
+            const int stores = is_store(instructions[i].op);
+            ptrdiff_t lo = instructions[i].offset, hi = lo;
+            for (j = i; j < op_count && (stores ?
+                    is_store(instructions[j].op) :
+                    instructions[j].op == op_modify); j++) {
+                if (instructions[j].offset < lo) {
+                    lo = instructions[j].offset;
+                }
+                if (instructions[j].offset > hi) {
+                    hi = instructions[j].offset;
+                }
+            }
+
+            if (j - i < MIN_LANES ||
+                    hi - lo >= max_span * (ptrdiff_t) (j - i)) {
+                /* Copy the instruction or run as it is. */
+                if (j == i) {
+                    j++;
+                }
+
+                for (; i < j; i++) {
+                    if (ret) {
+                        ret[out] = instructions[i];
+                    }
+                    out++;
+                }
+                continue;
+            }
+
+            out += vectorize_run(&instructions[i], j - i, lo, values, touched,
+                max_width, ret ? &ret[out] : NULL);
+        }
+
+        if (pass == 0) {
+            ret = malloc(sizeof(instruction_t) * (out + 1u));
+            if (!(ret)) {
+                free(values);
+                return NULL;
+            }
+        }
+    }
+
+    free(values);
+    *new_op_count = out;
+    return ret;
+}
+#undef MIN_LANES
+#endif
+
+/**
+ * Returns nonzero if the loop closing at instructions[close] is known to
+ * exit, as its body ends by storing zero to the cell it tests.  Only the
+ * straight-line code just before the close is examined.
+ */
+static int exits_once(const instruction_t * instructions, size_t close,
+        uint32_t mask) {
+    ptrdiff_t target = 0;
+    size_t i;
+    for (i = close; i-- > 0; ) {
+        const instruction_t * inst = &instructions[i];
+        switch (inst->op) {
+            case op_right:
+                target += inst->val;
+                continue;
+            case op_put:
+            case op_print:
+            case op_vadd:
+            case op_vstore:
+                continue;
+            case op_modify:
+            case op_clear:
+            case op_set:
+            case op_get:
+            case op_mul:
+            case op_lane:
+                break;
+            default:
+                return 0;
+        }
+
+        if (inst->offset != target) {
+            continue;
+        }
+
+        if (inst->op == op_lane) {
+            size_t header = i;
+            while (instructions[header].op == op_lane) {
+                header--;
+            }
+            return instructions[header].op == op_vstore &&
+                ((uint32_t) inst->val & mask) == 0;
+        }
+
+        return (inst->op == op_clear || inst->op == op_set) &&
+            ((uint32_t) inst->val & mask) == 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns nonzero for instructions that may appear in the body of an
+ * op_select.
+ */
+static int is_selectable(const instruction_t * inst, unsigned cell_size) {
+    switch (inst->op) {
+        case op_modify:
+        case op_clear:
+        case op_set:
+        case op_mul:
+            /* The code generated for them selects their address by masking
+             * their offset in bytes, which must be zero extended. */
+            return inst->offset >= 0 &&
+                inst->offset <= INT32_MAX / (ptrdiff_t) cell_size;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Each pass rewrites the program's instructions, returning interpret_ok or
+ * the error that stopped it.  Passes run before the program is linked, so
+ * they may add and remove loops freely.
+ */
+typedef int (*pass_fn_t)(program_t * program);
+
+static void replace_instructions(program_t * program,
+        instruction_t * instructions, size_t count) {
+    free(program->instructions);
+    program->instructions   = instructions;
+    program->count          = count;
+}
+
+static int pass_clears(program_t * program) {
+    program->count = condense_clears(program->instructions, program->count);
+    return interpret_ok;
+}
+
+static int pass_scans(program_t * program) {
+    program->count = condense_scans(program->instructions, program->count);
+    return interpret_ok;
+}
+
+static int pass_divmods(program_t * program) {
+    /* op_divmod checks and stores its cells as bytes. */
+    if (program->cell_size != 1) {
+        return interpret_ok;
+    }
+
+    program_t idiom;
+    int ret = parse_program(&idiom, divmod_idiom, sizeof(divmod_idiom) - 1u);
+    if (ret != interpret_ok) {
+        return ret;
+    }
+
+    size_t count;
+    instruction_t * instructions = condense_divmods(program->instructions,
+        program->count, &idiom, &count);
+    delete_program(&idiom);
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    replace_instructions(program, instructions, count);
+    return interpret_ok;
+}
+
+static int pass_constants(program_t * program) {
+    /* Known values, and the trip counts of unrolled loops, are modulo 256. */
+    if (program->cell_size != 1) {
+        return interpret_ok;
+    }
+
+    size_t count;
+    instruction_t * instructions =
+        propagate_constants(program->instructions, program->count,
+            program->tape_size, &count);
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    replace_instructions(program, instructions, count);
+    return interpret_ok;
+}
+
+static int pass_multiplies(program_t * program) {
+    size_t count;
+    instruction_t * instructions =
+        condense_multiplies(program->instructions, program->count, &count,
+            cell_mask(program->cell_size));
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    replace_instructions(program, instructions, count);
+    return interpret_ok;
+}
+
+static int pass_defer(program_t * program) {
+    size_t count;
+    instruction_t * instructions =
+        defer_moves(program->instructions, program->count, &count);
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    replace_instructions(program, instructions, count);
+    return interpret_ok;
+}
+
+#if defined(HOST_ARCH_X64)
+static int pass_vectorize(program_t * program) {
+    /* The lanes of op_vadd and op_vstore are bytes. */
+    if (program->cell_size != 1) {
+        return interpret_ok;
+    }
+
+    const ptrdiff_t max_width = (program->features & cpu_avx512bw) ? 64 :
+                                (program->features & cpu_avx2)     ? 32 : 16;
+
+    size_t count;
+    instruction_t * instructions =
+        vectorize_runs(program->instructions, program->count, &count,
+            max_width);
+    if (!(instructions)) {
+        return interpret_malloc_error;
+    }
+
+    replace_instructions(program, instructions, count);
+    return interpret_ok;
+}
+#endif
+
+/**
+ * Lower bounds on pointer positions and displacements, in cells.  UNBOUNDED
+ * stands for no bound at all, and finite bounds saturate at BOUND_LIMIT, so
+ * the sum of two never overflows.
+ */
+#define UNBOUNDED   PTRDIFF_MIN
+#define BOUND_LIMIT (PTRDIFF_MAX / 4)
+
+static ptrdiff_t add_bounds(ptrdiff_t a, ptrdiff_t b) {
+    if (a == UNBOUNDED || b == UNBOUNDED || a < -BOUND_LIMIT ||
+            b < -BOUND_LIMIT) {
+        return UNBOUNDED;
+    }
+
+    a = a > BOUND_LIMIT ? BOUND_LIMIT : a;
+    b = b > BOUND_LIMIT ? BOUND_LIMIT : b;
+    const ptrdiff_t sum = a + b;
+    if (sum > BOUND_LIMIT) {
+        return BOUND_LIMIT;
+    } else if (sum < -BOUND_LIMIT) {
+        return UNBOUNDED;
+    }
+
+    return sum;
+}
+
+static ptrdiff_t min_bound(ptrdiff_t a, ptrdiff_t b) {
+    return a < b ? a : b;
+}
+
+/**
+ * An enclosing loop or cold region, or a guard awaiting its region.  main is
+ * the bound on the path around the region and alt that on entering it, open
+ * is where a region starts, depth is how many regions enclose a guard, and
+ * redundant is set for a guard that can never branch.
+ */
+typedef struct bound_frame {
+    ptrdiff_t main;
+    ptrdiff_t alt;
+    size_t    open;
+    size_t    depth;
+    int       redundant;
+} bound_frame_t;
+
+/**
+ * Sets net[i], for each loop opened at i, to a lower bound on how far one
+ * pass through its body moves the pointer.  '<' counts in full, as clamping
+ * only moves the pointer less.  A guarded region is another path from its
+ * guard:  a cold region rejoins at its op_join, and a fallback loop stands in
+ * for the loop that holds its guard.  regions and guards need room for as
+ * many frames as there are instructions.
+ */
+static void loop_displacements(const instruction_t * instructions,
+        size_t op_count, ptrdiff_t * net, bound_frame_t * regions,
+        bound_frame_t * guards) {
+    size_t i, depth = 0, guard_count = 0;
+    ptrdiff_t d = 0;
+    for (i = 0; i < op_count; i++) {
+        const instruction_t * inst = &instructions[i];
+        switch (inst->op) {
+            case op_right:
+                d = add_bounds(d, inst->val);
+                break;
+            case op_left:
+                d = add_bounds(d, -inst->val);
+                break;
+            case op_scan:
+                if (inst->val < 0) {
+                    d = UNBOUNDED;
+                }
+                break;
+            case op_guard:
+                guards[guard_count].main  = d;
+                guards[guard_count].depth = depth;
+                guard_count++;
+                break;
+            case op_cold:
+                assert(guard_count > 0);
+                guard_count--;
+                assert(guards[guard_count].depth == depth);
+
+                regions[depth].main = d;
+                regions[depth].open = i;
+                depth++;
+                d = guards[guard_count].main;
+                break;
+            case op_join:
+                assert(depth > 0);
+                depth--;
+                d = min_bound(regions[depth].main, d);
+                break;
+            case op_if:
+            case op_fallback:
+                regions[depth].main = d;
+                regions[depth].alt  = d;
+                regions[depth].open = i;
+                if (inst->op == op_fallback) {
+                    /* Its guard was in the loop that just closed. */
+                    assert(guard_count > 0);
+                    guard_count--;
+                    assert(guards[guard_count].depth == depth + 1);
+                    regions[depth].alt =
+                        add_bounds(d, guards[guard_count].main);
+                }
+                depth++;
+                d = 0;
+                break;
+            case op_endif:
+                {
+                assert(depth > 0);
+                depth--;
+
+                /* Repeating a body that may move left has no bound. */
+                const bound_frame_t * loop = &regions[depth];
+                const ptrdiff_t repeated = d < 0 ? UNBOUNDED : 0;
+                net[loop->open] = d;
+                if (instructions[loop->open].op == op_fallback) {
+                    d = min_bound(loop->main, add_bounds(loop->alt, repeated));
+                } else {
+                    d = add_bounds(loop->main, repeated);
+                }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    assert(depth == 0);
+    assert(guard_count == 0);
+}
+
+/**
+ * Tracks the lowest cell the pointer may be at, from the start of the tape,
+ * through the program.  Where it shows that a '<' cannot reach the start of
+ * the tape, the move no longer needs to clamp and becomes an op_right with a
+ * negative val, and where it shows that a guard can never branch, the guard
+ * and its cold region or fallback loop are dropped.  A loop whose body may
+ * move the pointer left is assumed to reach the start of the tape.
+ *
+ * The pointer never leaves the tape on the left, whatever this finds:  moves
+ * it cannot prove keep their clamps.
+ */
+static int pass_bounds(program_t * program) {
+    instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+
+    ptrdiff_t * net = malloc(sizeof(ptrdiff_t) * (op_count + 1u));
+    bound_frame_t * regions =
+        malloc(sizeof(bound_frame_t) * (op_count + 1u));
+    bound_frame_t * guards = malloc(sizeof(bound_frame_t) * (op_count + 1u));
+    if (!(net) || !(regions) || !(guards)) {
+        free(net);
+        free(regions);
+        free(guards);
+        return interpret_malloc_error;
+    }
+
+    loop_displacements(instructions, op_count, net, regions, guards);
+
+    size_t i, depth = 0, guard_count = 0;
+    ptrdiff_t lo = 0;
+    for (i = 0; i < op_count; i++) {
+        instruction_t * inst = &instructions[i];
+        switch (inst->op) {
+            case op_right:
+                lo = add_bounds(lo, inst->val);
+                break;
+            case op_left:
+                {
+                const ptrdiff_t distance = inst->val;
+                if (lo >= distance) {
+                    inst->op    = op_right;
+                    inst->val   = -distance;
+                }
+                lo = add_bounds(lo, -distance);
+                }
+                break;
+            case op_scan:
+                if (inst->val < 0) {
+                    lo = 0;
+                }
+                break;
+            case op_guard:
+                guards[guard_count].main        = lo;
+                guards[guard_count].redundant   = lo >= inst->val;
+                guard_count++;
+
+                if (lo >= inst->val) {
+                    inst->op = op_invalid;
+                } else {
+                    lo = inst->val;
+                }
+                break;
+            case op_cold:
+            case op_fallback:
+                assert(guard_count > 0);
+                guard_count--;
+                if (guards[guard_count].redundant) {
+                    /* Unreachable; drop it, and anything it encloses. */
+                    size_t nested = 0;
+                    for (; ; i++) {
+                        const op_t op = instructions[i].op;
+                        nested += op == op_cold || op == op_if ||
+                            op == op_fallback;
+                        nested -= op == op_join || op == op_endif;
+                        instructions[i].op = op_invalid;
+                        if (nested == 0) {
+                            break;
+                        }
+                    }
+                    break;
+                }
+
+                regions[depth].main = lo;
+                regions[depth].open = i;
+                depth++;
+                lo = guards[guard_count].main;
+                if (inst->op == op_fallback && net[i] < 0) {
+                    lo = 0;
+                }
+                break;
+            case op_if:
+                regions[depth].main = lo;
+                regions[depth].open = i;
+                depth++;
+                if (net[i] < 0) {
+                    lo = 0;
+                }
+                break;
+            case op_join:
+            case op_endif:
+                assert(depth > 0);
+                depth--;
+                lo = min_bound(regions[depth].main, lo);
+                break;
+            default:
+                break;
+        }
+
+        if (lo < 0) {
+            lo = 0;
+        }
+    }
+    assert(depth == 0);
+    assert(guard_count == 0);
+
+    free(net);
+    free(regions);
+    free(guards);
+
+    size_t out = 0;
+    for (i = 0; i < op_count; i++) {
+        if (instructions[i].op != op_invalid) {
+            instructions[out++] = instructions[i];
+        }
+    }
+    program->count = out;
+
+    return interpret_ok;
+}
+#undef UNBOUNDED
+#undef BOUND_LIMIT
+
+/**
+ * Mark each loop whose body ends by clearing the cell it tests as known to
+ * exit, so its closing test is dropped, and replace those with bodies of at
+ * most MAX_SELECT simple instructions, such as what condense_multiplies
+ * leaves of [->+<], with op_select.  The program is rewritten in place.
+ */
+#define MAX_SELECT 4
+static int pass_select(program_t * program) {
+    instruction_t * instructions = program->instructions;
+    const size_t op_count = program->count;
+
+    size_t * opens = malloc(sizeof(size_t) * (op_count + 1u));
+    if (!(opens)) {
+        return interpret_malloc_error;
+    }
+
+    size_t i, depth = 0;
+    for (i = 0; i < op_count; i++) {
+        if (instructions[i].op == op_if || instructions[i].op == op_fallback) {
+            opens[depth++] = i;
+            continue;
+        } else if (instructions[i].op != op_endif) {
+            continue;
+        }
+
+        assert(depth > 0);
+        const size_t open = opens[--depth];
+        if (instructions[i].val == 0) {
+            instructions[i].val = exits_once(instructions, i,
+                cell_mask(program->cell_size));
+        }
+
+        if (instructions[open].op != op_if || instructions[open].val != 0 ||
+                instructions[i].val == 0 || i - open - 1 > MAX_SELECT) {
+            continue;
+        }
+
+        size_t j;
+        for (j = open + 1; j < i &&
+                is_selectable(&instructions[j], program->cell_size); j++) {
+            /* Check the body. */
+        }
+
+        if (j == i) {
+            instructions[open].op   = op_select;
+            instructions[open].val  = (ptrdiff_t) (i - open - 1);
+            instructions[i].op      = op_invalid;
+        }
+    }
+    assert(depth == 0);
+    free(opens);
+
+    size_t out = 0;
+    for (i = 0; i < op_count; i++) {
+        if (instructions[i].op != op_invalid) {
+            instructions[out++] = instructions[i];
+        }
+    }
+    program->count = out;
+
+    return interpret_ok;
+}
+#undef MAX_SELECT
+
+typedef struct pass {
+    unsigned  level;
+    pass_fn_t run;
+} pass_t;
+
+/**
+ * The passes, in the order they run, with the lowest optimization level that
+ * enables each.  Level 1 passes are single linear rewrites; level 2 adds
+ * those that do real analysis or grow the program.
+ */
+static const pass_t passes[] = {
+    {1, pass_divmods},
+    {1, pass_clears},
+    {1, pass_scans},
+    {2, pass_constants},
+    {1, pass_multiplies},
+    {1, pass_defer},
+    #if defined(HOST_ARCH_X64)
+    {2, pass_vectorize},
+    #endif
+    {1, pass_bounds},
+    {1, pass_select},
+};
+
+int optimize_program(program_t * program, unsigned level) {
+    assert(program);
+
+    size_t i;
+    for (i = 0; i < sizeof(passes) / sizeof(passes[0]); i++) {
+        if (passes[i].level > level) {
+            continue;
+        }
+
+        int ret = passes[i].run(program);
+        if (ret != interpret_ok) {
+            return ret;
+        }
+    }
+
+    return interpret_ok;
+}
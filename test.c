@@ -32,12 +32,16 @@ static const char * test_output;
 static size_t       test_output_size;
 static size_t       test_output_offset;
 
+static size_t       test_putchar_count;
+static size_t       test_putstr_count;
+
 typedef enum test_error {
     test_okay               = 0,
     test_incorrect_write    = 1,
     test_insufficient_write = 2,
     test_excess_write       = 3,
-    test_invalid_test       = 4
+    test_invalid_test       = 4,
+    test_unexpected_ok      = 5
 } test_error;
 
 static int test_getchar(void) {
@@ -51,7 +55,7 @@ static int test_getchar(void) {
     return ret;
 }
 
-static int test_putchar(int ch) {
+static int test_check_char(int ch) {
     assert(test_output_offset <= test_output_size);
     if (test_output_offset >= test_output_size) {
         /* Writing past end of expected output */
@@ -74,9 +78,40 @@ static int test_putchar(int ch) {
     return ch;
 }
 
+static int test_putchar(int ch) {
+    test_putchar_count++;
+    return test_check_char(ch);
+}
+
+void test_putstr(const char * str, size_t size) {
+    test_putstr_count++;
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        test_check_char((unsigned char) str[i]);
+    }
+}
+
+size_t test_putchar_calls(void) {
+    return test_putchar_count;
+}
+
+size_t test_putstr_calls(void) {
+    return test_putstr_count;
+}
+
 int test_interpreter(const char * program, size_t program_size,
         size_t max_data_size, int return_code, const char * input,
         size_t input_size, const char * output, size_t output_size) {
+    return test_interpreter_with_options(program, program_size,
+        max_data_size, return_code, input, input_size, output, output_size,
+        NULL);
+}
+
+int test_interpreter_with_options(const char * program, size_t program_size,
+        size_t max_data_size, int return_code, const char * input,
+        size_t input_size, const char * output, size_t output_size,
+        const interpret_options_t * options) {
     /* Store parameters in global buffer as we do not have closures to
      * help us. */
     if (input && input_size > 0) {
@@ -97,6 +132,8 @@ int test_interpreter(const char * program, size_t program_size,
         test_output_size    = 0u;
     }
     test_output_offset  = 0u;
+    test_putchar_count  = 0u;
+    test_putstr_count   = 0u;
 
     /* Store state. */
     int jmpret = setjmp(test_jmpbuf);
@@ -104,10 +141,11 @@ int test_interpreter(const char * program, size_t program_size,
         return jmpret;
     }
 
-    int ret = interpret(program, program_size, max_data_size, NULL,
-        test_getchar, test_putchar);
+    int ret = interpret_with_options(program, program_size, max_data_size,
+        NULL, test_getchar, test_putchar, options);
     if (ret != return_code) {
-        return -ret;
+        /* -interpret_ok would read as success. */
+        return ret == interpret_ok ? test_unexpected_ok : -ret;
     }
 
     /* Check output */
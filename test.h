@@ -19,10 +19,28 @@
 #ifndef __BF__TEST_H__
 #define __BF__TEST_H__
 
+#include "interpreter.h"
 #include <string.h>
 
 int test_interpreter(const char * program, size_t program_size,
     size_t max_data_size, int return_code, const char * input,
     size_t input_size, const char * output, size_t output_size);
+int test_interpreter_with_options(const char * program, size_t program_size,
+    size_t max_data_size, int return_code, const char * input,
+    size_t input_size, const char * output, size_t output_size,
+    const interpret_options_t * options);
+
+/**
+ * A bulk output sink for interpret_options_t, checked against the expected
+ * output like the tests' putchar.
+ */
+void test_putstr(const char * str, size_t size);
+
+/**
+ * The number of calls made to the tests' putchar and to test_putstr during
+ * the last test.  test_putstr does not count towards the former.
+ */
+size_t test_putchar_calls(void);
+size_t test_putstr_calls(void);
 
 #endif // __BF__TEST_H__